@@ -83,14 +83,21 @@ enum threadexec_value_disposition {
 	TX_DISPOSITION_LITERAL = 0x0,
 	// Copy the data in the local buffer to the remote thread and pass a pointer to the remote
 	// copy to the function. The remote input data buffer is live only for the duration of the
-	// remote function call.
+	// remote function call. If the local buffer lies in shared memory (the client region or a
+	// region from threadexec_shared_vm_allocate), no copy is made and the function is passed
+	// the remote address of the buffer itself, so any changes the function makes to its input
+	// are visible in the local buffer.
 	TX_DISPOSITION_PTR_DATA_IN = 0x1,
 	// Pass a pointer to a remote output buffer of the specified size to the function and copy
 	// the data back to the local output buffer when the function returns. The remote output
-	// buffer is live only for the duration of the remote function call.
+	// buffer is live only for the duration of the remote function call. If the local buffer
+	// lies in shared memory, no copy is made: the function is passed the remote address of the
+	// buffer itself and writes its output there directly.
 	TX_DISPOSITION_PTR_DATA_OUT = 0x2,
 	// A combination of TX_DISPOSITION_DATA_IN and TX_DISPOSITION_PTR_DATA_OUT,
-	// suitable for example when a function modifies a buffer in-place.
+	// suitable for example when a function modifies a buffer in-place. If the local buffer
+	// lies in shared memory, the function is passed the remote address of the buffer itself
+	// and modifies it in place.
 	TX_DISPOSITION_PTR_DATA_INOUT = 0x3,
 };
 
@@ -164,6 +171,10 @@ enum {
 	// The thread port is a bare Mach thread with no associated pthread state. Use this flag
 	// for a thread created via thread_create().
 	TX_BARE_THREAD        = 0x80,
+	// Have threadexec_read() and threadexec_write() copy memory with mach_vm_read_overwrite()
+	// and mach_vm_write() rather than memcpy(), so that a bad remote address produces an error
+	// instead of crashing the target thread.
+	TX_SAFE_MEMORY_ACCESS = 0x100,
 };
 
 typedef uint32_t tx_create_flags_t;
@@ -202,6 +213,72 @@ typedef uint32_t tx_create_flags_t;
  */
 threadexec_t threadexec_init(task_t task, thread_t thread, tx_create_flags_t flags);
 
+/*
+ * threadexec_init_options
+ *
+ * Description:
+ * 	The geometry of the shared memory region used by a threadexec context. A field that is 0
+ * 	takes its default value.
+ */
+struct threadexec_init_options {
+	// The number of bytes the remote thread's stack can grow. Default 64K.
+	size_t stack_size;
+	// The size of the client shared memory region returned by threadexec_shared_vm_default.
+	// Default 32K.
+	size_t client_shmem_size;
+	// The size of each staging buffer used for bulk memory transfers. Default 16K.
+	size_t staging_buffer_size;
+	// The number of staging buffers. Must be at least 2. Default 2.
+	unsigned staging_buffer_count;
+	// The granularity to which the stack and client regions are rounded up. Must be a power of
+	// 2 and a multiple of the page size. Default 16K.
+	size_t alignment;
+	// Try to back the shared memory region with superpages, as with TX_SHARED_VM_SUPERPAGE.
+	// The client region is grown so that the whole region is a multiple of 2MB.
+	bool superpages;
+	// Fault in the staging buffers and stack on both sides during initialization, and the
+	// shared regions used for large threadexec_call_c arguments when they are created, so that
+	// the first calls don't take page faults.
+	bool prefault;
+	// Also wire the staging buffers and stack on both sides. Implies prefault. Wiring is
+	// subject to the memory lock limits of each task and is skipped if it fails.
+	bool wire;
+};
+
+/*
+ * threadexec_init_with_options
+ *
+ * Description:
+ * 	Initialize a threadexec_t context like threadexec_init, with a custom shared memory
+ * 	geometry.
+ *
+ * Parameters:
+ * 	task				The task, as for threadexec_init.
+ * 	thread				The thread, as for threadexec_init.
+ * 	flags				Creation/behavior flags.
+ * 	options				The shared memory geometry, or NULL for the defaults.
+ *
+ * Returns:
+ * 	Returns a new threadexec_t object on success and NULL on failure.
+ *
+ * Notes:
+ * 	The shared memory region is laid out as the staging buffers, a 16K guard page, the stack,
+ * 	and the client region, so its total size is the sum of these rounded up to the alignment.
+ * 	The defaults give a 144K region. The guard page is inaccessible in the remote task, so a
+ * 	stack overflow faults rather than silently overwriting the staging buffers. No exception
+ * 	handler is installed for the fault, so an overflow crashes the target process; size the
+ * 	stack with threadexec_stack_profile_enable.
+ *
+ * 	Pointer arguments to threadexec_call_c whose data fits in the staging buffers are passed in
+ * 	place; larger ones are passed in shared memory regions taken from a per-context pool,
+ * 	which are mapped on first use and then reused across calls. The pool keeps up to 16MB
+ * 	idle; release it with threadexec_shared_vm_pool_trim. Increase the staging buffers to keep
+ * 	large arguments out of the pool, or shrink everything to reduce the footprint of many
+ * 	contexts.
+ */
+threadexec_t threadexec_init_with_options(task_t task, thread_t thread, tx_create_flags_t flags,
+		const struct threadexec_init_options *options);
+
 /*
  * threadexec_deinit
  *
@@ -452,6 +529,40 @@ void threadexec_shared_vm_default(threadexec_t threadexec,
 bool threadexec_shared_vm_allocate(threadexec_t threadexec,
 		const void **remote_address, void **local_address, size_t size);
 
+// Flags for threadexec_shared_vm_allocate_flags.
+enum {
+	// Try to back the region with superpages (2MB pages) to reduce TLB misses on large
+	// buffers. Only regions whose size is a multiple of 2MB are eligible.
+	TX_SHARED_VM_SUPERPAGE = 0x1,
+};
+
+/*
+ * threadexec_shared_vm_allocate_flags
+ *
+ * Description:
+ * 	Allocate a region of virtual memory that is shared between the current task and the remote
+ * 	thread, as threadexec_shared_vm_allocate, with allocation flags.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address		out	On return, the address of the shared memory region in the
+ * 					remote thread.
+ * 	local_address		out	On return, the address of the shared memory region in the
+ * 					local task.
+ * 	size				The size of the shared memory region to allocate.
+ * 	flags				TX_SHARED_VM_SUPERPAGE.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	Superpages are a best effort. If the kernel doesn't support them for this region (they are
+ * 	generally unavailable on arm64), the region is silently backed by regular pages instead.
+ * 	Superpage memory is wired. Free the region with threadexec_shared_vm_deallocate.
+ */
+bool threadexec_shared_vm_allocate_flags(threadexec_t threadexec,
+		const void **remote_address, void **local_address, size_t size, unsigned flags);
+
 /*
  * threadexec_shared_vm_deallocate
  *
@@ -474,6 +585,121 @@ bool threadexec_shared_vm_allocate(threadexec_t threadexec,
 void threadexec_shared_vm_deallocate(threadexec_t threadexec,
 		const void *remote_address, void *local_address, size_t size);
 
+/*
+ * threadexec_shared_vm_remote_address
+ *
+ * Description:
+ * 	Translate a local pointer into shared memory to the corresponding remote address.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	local_address			The local address.
+ * 	size				The size of the range starting at local_address that must
+ * 					lie in the same shared region.
+ * 	remote_address		out	On return, the remote address.
+ *
+ * Returns:
+ * 	Returns true if the range lies in the default shared memory region or in a live region
+ * 	allocated with threadexec_shared_vm_allocate.
+ *
+ * Notes:
+ * 	threadexec_call_c performs this translation automatically: a TX_DISPOSITION_PTR_DATA_*
+ * 	argument whose data already lies in shared memory is passed by its remote address, with no
+ * 	copying in either direction. This means the remote function operates on the caller's
+ * 	buffer directly, even for TX_DISPOSITION_PTR_DATA_IN.
+ */
+bool threadexec_shared_vm_remote_address(threadexec_t threadexec, const void *local_address,
+		size_t size, const void **remote_address);
+
+/*
+ * threadexec_shared_vm_local_address
+ *
+ * Description:
+ * 	Translate a remote pointer into shared memory to the corresponding local address. This is
+ * 	the inverse of threadexec_shared_vm_remote_address.
+ */
+bool threadexec_shared_vm_local_address(threadexec_t threadexec, const void *remote_address,
+		size_t size, void **local_address);
+
+/*
+ * threadexec_shared_vm_translate_pointers
+ *
+ * Description:
+ * 	Translate the pointers embedded in a buffer from local to remote addresses in place, so
+ * 	that a structure built in shared memory can be followed by remote code.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	data				The buffer containing the pointers.
+ * 	pointer_offsets			The offsets of the pointer-sized fields in data to translate.
+ * 	pointer_count			The number of offsets.
+ *
+ * Returns:
+ * 	Returns true on success. NULL pointers are left as they are. If any other pointer is not
+ * 	in shared memory, false is returned and the buffer is left unchanged.
+ */
+bool threadexec_shared_vm_translate_pointers(threadexec_t threadexec, void *data,
+		const size_t *pointer_offsets, size_t pointer_count);
+
+/*
+ * threadexec_shared_memory_usage
+ *
+ * Description:
+ * 	The memory held by a threadexec context for shared memory, as reported by
+ * 	threadexec_shared_memory_usage.
+ */
+struct threadexec_shared_memory_usage {
+	// The size of the session shared memory region.
+	size_t shmem_size;
+	// The number of bytes of the session region that were prefaulted on both sides.
+	size_t prefaulted_size;
+	// The number of bytes of the session region that are wired on both sides. Each side
+	// counts this against its own memory.
+	size_t wired_size;
+	// The total size of the regions in the pool used for large threadexec_call_c arguments.
+	size_t pool_size;
+	// The part of pool_size that is idle.
+	size_t pool_idle_size;
+};
+
+/*
+ * threadexec_shared_memory_usage
+ *
+ * Description:
+ * 	Report how much memory the threadexec context holds for shared memory, so that the cost of
+ * 	options like prefaulting and wiring can be judged.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	usage			out	On return, the memory usage.
+ *
+ * Notes:
+ * 	Shared regions are mapped in both tasks but backed by the same physical pages, so every
+ * 	size here is the physical cost once, plus page tables on each side.
+ */
+void threadexec_shared_memory_usage(threadexec_t threadexec,
+		struct threadexec_shared_memory_usage *usage);
+
+/*
+ * threadexec_shared_vm_pool_trim
+ *
+ * Description:
+ * 	Release idle shared memory regions held for large threadexec_call_c arguments.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	idle_limit			The number of idle bytes to keep. Pass 0 to release every
+ * 					idle region.
+ *
+ * Notes:
+ * 	Pointer arguments to threadexec_call_c that don't fit in the staging buffers are passed in
+ * 	shared memory regions taken from a per-context pool. The regions are bucketed into
+ * 	power-of-2 size classes and reused across calls, so after warm-up a large-argument call
+ * 	needs no extra mappings. The pool keeps at most 16MB idle on its own; call this function to
+ * 	give memory back sooner, for example in response to a memory pressure notification.
+ */
+void threadexec_shared_vm_pool_trim(threadexec_t threadexec, size_t idle_limit);
+
 /*
  * threadexec_mach_vm_deallocate
  *
@@ -532,6 +758,1600 @@ bool threadexec_read(threadexec_t threadexec,
 bool threadexec_write(threadexec_t threadexec,
 		const void *remote_address, const void *data, size_t size);
 
+/*
+ * threadexec_iovec
+ *
+ * Description:
+ * 	A single segment of a scatter-gather memory transfer with threadexec_readv or
+ * 	threadexec_writev.
+ */
+struct threadexec_iovec {
+	// The address in the remote thread.
+	const void *remote_address;
+	// The local buffer. For threadexec_writev this buffer is only read.
+	void *data;
+	// The number of bytes to transfer.
+	size_t size;
+	// On return, the number of bytes that were transferred. The segment was transferred
+	// successfully if this is equal to size.
+	size_t transferred;
+};
+
+/*
+ * threadexec_read_stream_fn
+ *
+ * Description:
+ * 	The type of the consumer callback for threadexec_read_stream.
+ *
+ * Parameters:
+ * 	context				The context passed to threadexec_read_stream.
+ * 	remote_address			The remote address of this chunk.
+ * 	data				The contents of the chunk. The buffer is only valid for the
+ * 					duration of the callback.
+ * 	size				The size of the chunk.
+ *
+ * Returns:
+ * 	Return true to continue the stream or false to stop it.
+ */
+typedef bool (*threadexec_read_stream_fn)(void *context, const void *remote_address,
+		const void *data, size_t size);
+
+/*
+ * threadexec_read_stream
+ *
+ * Description:
+ * 	Read a region of remote memory in successive chunks, passing each chunk to a consumer.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote address to read from.
+ * 	size				The number of bytes to read.
+ * 	pipelined			If true, the remote thread copies the next chunk while the
+ * 					consumer processes the current one. The consumer must not
+ * 					use the threadexec context in this mode.
+ * 	consumer			The consumer callback, called with the chunks in order.
+ * 	context				A context pointer passed to the consumer.
+ *
+ * Returns:
+ * 	Returns true if the whole region was read and consumed. Returns false if a read failed or
+ * 	the consumer stopped the stream.
+ *
+ * Notes:
+ * 	No local memory proportional to the size of the region is used: chunks are passed to the
+ * 	consumer directly from the staging buffers in the shared memory region. The read cache is
+ * 	not used.
+ */
+bool threadexec_read_stream(threadexec_t threadexec, const void *remote_address, size_t size,
+		bool pipelined, threadexec_read_stream_fn consumer, void *context);
+
+/*
+ * threadexec_read_safe
+ *
+ * Description:
+ * 	Read memory from the remote task without risking a crash on a bad address.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote address to read from.
+ * 	data				The local buffer in which to store the data.
+ * 	size				The number of bytes to read.
+ * 	copied			out	On return, the number of bytes at the start of the range that
+ * 					were read. May be NULL.
+ *
+ * Returns:
+ * 	Returns true if the whole range was read.
+ *
+ * Notes:
+ * 	The copy is done by the kernel with mach_vm_read_overwrite, either directly with the task
+ * 	API or by the remote thread on its own task. When a chunk fails, it is retried page by page
+ * 	to find exactly how much could be read.
+ *
+ * 	The read cache is not used. This is the path threadexec_read takes for every transfer when
+ * 	the threadexec was created with TX_SAFE_MEMORY_ACCESS.
+ */
+bool threadexec_read_safe(threadexec_t threadexec, const void *remote_address, void *data,
+		size_t size, size_t *copied);
+
+/*
+ * threadexec_write_safe
+ *
+ * Description:
+ * 	Write memory in the remote task without risking a crash on a bad address.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote address to write to.
+ * 	data				The data to write.
+ * 	size				The number of bytes to write.
+ * 	copied			out	On return, the number of bytes at the start of the range that
+ * 					were written. May be NULL.
+ *
+ * Returns:
+ * 	Returns true if the whole range was written.
+ *
+ * Notes:
+ * 	See threadexec_read_safe. The copy is done with mach_vm_write, which fails on memory that
+ * 	is not writable rather than overriding the protection.
+ */
+bool threadexec_write_safe(threadexec_t threadexec, const void *remote_address, const void *data,
+		size_t size, size_t *copied);
+
+/*
+ * threadexec_readv
+ *
+ * Description:
+ * 	Read many non-contiguous regions of memory from the remote thread into local buffers.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	iov			inout	An array of segments to read. On return, the transferred
+ * 					field of each segment is set.
+ * 	count				The number of segments.
+ *
+ * Returns:
+ * 	Returns true if every segment was read in full.
+ *
+ * Notes:
+ * 	Segments are batched together so that many small reads cost a single remote call. A
+ * 	segment that covers unmapped remote memory is reported as a short transfer rather than
+ * 	crashing the remote thread.
+ */
+bool threadexec_readv(threadexec_t threadexec, struct threadexec_iovec *iov, size_t count);
+
+/*
+ * threadexec_writev
+ *
+ * Description:
+ * 	Write many local buffers into non-contiguous regions of memory in the remote thread.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	iov			inout	An array of segments to write. On return, the transferred
+ * 					field of each segment is set.
+ * 	count				The number of segments.
+ *
+ * Returns:
+ * 	Returns true if every segment was written in full.
+ *
+ * Notes:
+ * 	See threadexec_readv.
+ */
+bool threadexec_writev(threadexec_t threadexec, struct threadexec_iovec *iov, size_t count);
+
+/*
+ * threadexec_read_cache_stats
+ *
+ * Description:
+ * 	Counters describing the effectiveness of the read cache.
+ */
+struct threadexec_read_cache_stats {
+	// The number of pages that were found in the cache.
+	uint64_t hits;
+	// The number of pages that had to be fetched from the remote thread.
+	uint64_t misses;
+	// The number of pages fetched speculatively by read-ahead.
+	uint64_t readahead;
+	// The number of read-ahead pages that were later used by a read.
+	uint64_t readahead_hits;
+	// The number of valid pages evicted to make room for new ones.
+	uint64_t evictions;
+	// The number of reads that were too large to cache and went directly to the remote thread.
+	uint64_t bypasses;
+};
+
+/*
+ * threadexec_read_cache_enable
+ *
+ * Description:
+ * 	Enable a page-granular cache of remote memory for threadexec_read.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	cache_size			The maximum number of bytes of remote memory to cache. The
+ * 					least recently used pages are evicted beyond this bound.
+ * 	readahead_size			The number of bytes to fetch beyond the end of a read once
+ * 					sequential access is detected. Pass 0 to disable read-ahead.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	Writes through threadexec_write and threadexec_writev keep the cache coherent. Remote
+ * 	memory modified in any other way, including by remote function calls or by other threads
+ * 	in the task, is not tracked: use threadexec_read_cache_invalidate or
+ * 	threadexec_read_cache_new_epoch to discard stale data.
+ *
+ * 	Cache fills go through threadexec_readv, so read-ahead past the end of a mapping does
+ * 	not crash the remote thread.
+ *
+ * 	Enabling the cache when it is already enabled resets it with the new parameters.
+ */
+bool threadexec_read_cache_enable(threadexec_t threadexec,
+		size_t cache_size, size_t readahead_size);
+
+/*
+ * threadexec_read_cache_disable
+ *
+ * Description:
+ * 	Disable the read cache and free all cached pages.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ */
+void threadexec_read_cache_disable(threadexec_t threadexec);
+
+/*
+ * threadexec_read_cache_invalidate
+ *
+ * Description:
+ * 	Discard any cached pages overlapping the specified range of remote memory.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The start of the remote range.
+ * 	size				The size of the remote range.
+ */
+void threadexec_read_cache_invalidate(threadexec_t threadexec,
+		const void *remote_address, size_t size);
+
+/*
+ * threadexec_read_cache_new_epoch
+ *
+ * Description:
+ * 	Start a new cache epoch. All pages cached in earlier epochs are treated as stale. This is a
+ * 	constant-time way to invalidate the whole cache, for example after resuming the target.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ *
+ * Returns:
+ * 	The new epoch number.
+ */
+uint64_t threadexec_read_cache_new_epoch(threadexec_t threadexec);
+
+/*
+ * threadexec_read_cache_get_stats
+ *
+ * Description:
+ * 	Retrieve the read cache counters.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	stats			out	On return, the cache counters. All counters are zero if
+ * 					the cache is not enabled.
+ */
+void threadexec_read_cache_get_stats(threadexec_t threadexec,
+		struct threadexec_read_cache_stats *stats);
+
+/*
+ * threadexec_write_buffer_enable
+ *
+ * Description:
+ * 	Enable write combining for threadexec_write. Small writes are held locally, merged with
+ * 	overlapping and adjacent pending writes, and flushed to the remote task together.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	capacity			The maximum number of bytes of remote memory, in 4 KB pages,
+ * 					that may have pending writes. The buffer is flushed when a
+ * 					write would exceed this bound. Writes larger than the
+ * 					capacity are performed directly.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	Pending writes are flushed with threadexec_writev before any remote function call, before
+ * 	any threadexec_read or threadexec_readv that overlaps them, and on
+ * 	threadexec_write_buffer_flush. The target's other threads do not see pending writes.
+ *
+ * 	While the buffer is enabled threadexec_write always succeeds; a write that fails to land
+ * 	is reported by the flush instead. The flush is a single remote call as long as the pending
+ * 	data fits in one scatter-gather batch (16 KB).
+ *
+ * 	Enabling the buffer when it is already enabled flushes it and resets it with the new
+ * 	capacity.
+ */
+bool threadexec_write_buffer_enable(threadexec_t threadexec, size_t capacity);
+
+/*
+ * threadexec_write_buffer_disable
+ *
+ * Description:
+ * 	Flush any pending writes and disable write combining.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ *
+ * Returns:
+ * 	Returns true if all pending writes were flushed successfully.
+ */
+bool threadexec_write_buffer_disable(threadexec_t threadexec);
+
+/*
+ * threadexec_write_buffer_flush
+ *
+ * Description:
+ * 	Write all pending writes to the remote task.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ *
+ * Returns:
+ * 	Returns true if all pending writes were written successfully, and every implicit flush
+ * 	since the last call to threadexec_write_buffer_flush succeeded too. The buffer is empty
+ * 	afterwards in either case.
+ */
+bool threadexec_write_buffer_flush(threadexec_t threadexec);
+
+/*
+ * threadexec_graph_schema
+ *
+ * Description:
+ * 	A description of the nodes of a remote linked data structure for threadexec_graph_fetch.
+ */
+struct threadexec_graph_schema {
+	// The size of each node in bytes.
+	size_t node_size;
+	// The offsets of the pointer fields within a node that should be followed.
+	const size_t *pointer_offsets;
+	// The number of pointer fields.
+	size_t pointer_count;
+	// The maximum number of pointers to follow from the root. A depth of 0 fetches only the
+	// root node.
+	unsigned max_depth;
+	// The maximum number of nodes to fetch.
+	size_t max_nodes;
+};
+
+/*
+ * threadexec_graph_t
+ *
+ * Description:
+ * 	An opaque type holding a local copy of a fetched remote object graph.
+ */
+typedef struct threadexec_graph *threadexec_graph_t;
+
+/*
+ * threadexec_graph_fetch
+ *
+ * Description:
+ * 	Fetch the remote object graph reachable from a root node.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	root				The remote address of the root node.
+ * 	schema				The layout of the nodes.
+ * 	graph			out	On return, the local copy of the graph. Free the graph
+ * 					with threadexec_graph_free.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	The graph is fetched breadth-first. All the nodes at one depth are read with a single
+ * 	threadexec_readv, so the number of round trips grows with the depth of the graph and the
+ * 	amount of data rather than the number of nodes: threadexec_readv transfers at most 16K
+ * 	(and as many segments as fit in a staging buffer) per round trip, so a level whose nodes
+ * 	total more than that takes several. Each node is fetched once even if it is reachable
+ * 	along multiple paths. Pointers that refer to unreadable memory are skipped, and an
+ * 	unreadable address is only tried once.
+ *
+ * 	Fetching stops once max_depth or max_nodes is reached. The root node must be readable.
+ */
+bool threadexec_graph_fetch(threadexec_t threadexec, const void *root,
+		const struct threadexec_graph_schema *schema, threadexec_graph_t *graph);
+
+/*
+ * threadexec_graph_node_count
+ *
+ * Description:
+ * 	Get the number of nodes in a fetched graph.
+ */
+size_t threadexec_graph_node_count(threadexec_graph_t graph);
+
+/*
+ * threadexec_graph_node
+ *
+ * Description:
+ * 	Get a node of a fetched graph by index. Nodes are stored in breadth-first order, so index
+ * 	0 is the root.
+ *
+ * Parameters:
+ * 	graph				The graph.
+ * 	index				The index of the node.
+ * 	remote_address		out	If not NULL, on return, the remote address of the node.
+ *
+ * Returns:
+ * 	The local copy of the node.
+ */
+const void *threadexec_graph_node(threadexec_graph_t graph, size_t index,
+		const void **remote_address);
+
+/*
+ * threadexec_graph_lookup
+ *
+ * Description:
+ * 	Translate the remote address of a node into the address of its local copy.
+ *
+ * Parameters:
+ * 	graph				The graph.
+ * 	remote_address			The remote address of the node.
+ *
+ * Returns:
+ * 	The local copy of the node, or NULL if the node was not fetched.
+ */
+const void *threadexec_graph_lookup(threadexec_graph_t graph, const void *remote_address);
+
+/*
+ * threadexec_graph_free
+ *
+ * Description:
+ * 	Free a graph returned by threadexec_graph_fetch.
+ */
+void threadexec_graph_free(threadexec_graph_t graph);
+
+/*
+ * threadexec_remote_memset
+ *
+ * Description:
+ * 	Fill remote memory with a byte value without transferring any data.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote address to fill.
+ * 	value				The byte value.
+ * 	size				The number of bytes to fill.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_remote_memset(threadexec_t threadexec,
+		const void *remote_address, int value, size_t size);
+
+/*
+ * threadexec_remote_memmove
+ *
+ * Description:
+ * 	Copy remote memory to another remote address without transferring any data. The regions
+ * 	may overlap.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_destination		The remote destination address.
+ * 	remote_source			The remote source address.
+ * 	size				The number of bytes to copy.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_remote_memmove(threadexec_t threadexec,
+		const void *remote_destination, const void *remote_source, size_t size);
+
+/*
+ * threadexec_remote_memcmp
+ *
+ * Description:
+ * 	Compare two regions of remote memory without transferring any data.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address_1		The first remote region.
+ * 	remote_address_2		The second remote region.
+ * 	size				The number of bytes to compare.
+ * 	result			out	On return, the result of memcmp().
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_remote_memcmp(threadexec_t threadexec,
+		const void *remote_address_1, const void *remote_address_2, size_t size,
+		int *result);
+
+/*
+ * threadexec_remote_memmem
+ *
+ * Description:
+ * 	Search remote memory for a local byte pattern. Only the match address is transferred back.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote region to search.
+ * 	size				The size of the remote region.
+ * 	pattern				The local pattern to search for.
+ * 	pattern_size			The size of the pattern.
+ * 	found			out	On return, the remote address of the first match, or NULL
+ * 					if the pattern was not found.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_remote_memmem(threadexec_t threadexec,
+		const void *remote_address, size_t size,
+		const void *pattern, size_t pattern_size, const void **found);
+
+/*
+ * threadexec_remote_strlen
+ *
+ * Description:
+ * 	Get the length of a remote C string without transferring it.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_string			The remote string.
+ * 	max_length			The maximum number of bytes to examine. This bounds the
+ * 					search so that an unterminated string can't run off the end
+ * 					of a mapping.
+ * 	length			out	On return, the length of the string, or max_length if no
+ * 					terminator was found.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_remote_strlen(threadexec_t threadexec,
+		const char *remote_string, size_t max_length, size_t *length);
+
+/*
+ * threadexec_remote_sha256
+ *
+ * Description:
+ * 	Compute the SHA-256 digest of remote memory without transferring it.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote region to hash.
+ * 	size				The size of the remote region.
+ * 	digest			out	On return, the 32-byte digest.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_remote_sha256(threadexec_t threadexec,
+		const void *remote_address, size_t size, uint8_t digest[32]);
+
+/*
+ * threadexec_snapshot_range
+ *
+ * Description:
+ * 	A range of remote memory to snapshot with threadexec_snapshot_region.
+ */
+struct threadexec_snapshot_range {
+	// The remote address of the range.
+	const void *remote_address;
+	// The size of the range.
+	size_t size;
+	// On return, the local address of the snapshot of the range.
+	const void *local_address;
+};
+
+/*
+ * threadexec_snapshot_region
+ *
+ * Description:
+ * 	Take a copy-on-write snapshot of ranges of remote memory and map it read-only into the
+ * 	local task.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	ranges			inout	The ranges to snapshot. On return, the local_address field of
+ * 					each range is set.
+ * 	count				The number of ranges.
+ * 	pause				If true, all other threads in the task are suspended while
+ * 					the snapshot is taken so that the ranges are consistent with
+ * 					each other. The pause lasts only as long as it takes to set
+ * 					up the virtual copies, not to copy the data. With only the
+ * 					thread API, the remote thread suspends the other threads one
+ * 					by one, so a thread created during the pause is not paused.
+ *
+ * Returns:
+ * 	Returns true if every range was snapshotted. On failure, no snapshots are left mapped.
+ *
+ * Notes:
+ * 	The snapshot is a virtual copy: no data is copied until the target writes to a page. Later
+ * 	changes to the target's memory are not reflected in the snapshot.
+ *
+ * 	Release the snapshot with threadexec_snapshot_release.
+ */
+bool threadexec_snapshot_region(threadexec_t threadexec,
+		struct threadexec_snapshot_range *ranges, size_t count, bool pause);
+
+/*
+ * threadexec_snapshot_release
+ *
+ * Description:
+ * 	Unmap snapshots created by threadexec_snapshot_region.
+ *
+ * Parameters:
+ * 	ranges				The ranges passed to threadexec_snapshot_region.
+ * 	count				The number of ranges.
+ */
+void threadexec_snapshot_release(const struct threadexec_snapshot_range *ranges, size_t count);
+
+/*
+ * threadexec_mirror_t
+ *
+ * Description:
+ * 	An opaque type holding a local copy of a range of remote memory that can be brought up to
+ * 	date incrementally.
+ */
+typedef struct threadexec_mirror *threadexec_mirror_t;
+
+/*
+ * threadexec_mirror_change
+ *
+ * Description:
+ * 	A range of a mirror that changed during a sync.
+ */
+struct threadexec_mirror_change {
+	// The offset of the changed range from the start of the mirror.
+	size_t offset;
+	// The size of the changed range.
+	size_t size;
+};
+
+/*
+ * threadexec_mirror_create
+ *
+ * Description:
+ * 	Create a local mirror of a range of remote memory.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The start of the remote range.
+ * 	size				The size of the remote range.
+ * 	block_size			The granularity at which changes are detected and reported.
+ * 					Pass 0 to use the default of 256 bytes.
+ * 	mirror			out	On return, the mirror. Free the mirror with
+ * 					threadexec_mirror_free.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_mirror_create(threadexec_t threadexec, const void *remote_address, size_t size,
+		size_t block_size, threadexec_mirror_t *mirror);
+
+/*
+ * threadexec_mirror_data
+ *
+ * Description:
+ * 	Get the local copy of the mirrored range. The copy is updated in place by
+ * 	threadexec_mirror_sync.
+ */
+const void *threadexec_mirror_data(threadexec_mirror_t mirror);
+
+/*
+ * threadexec_mirror_sync
+ *
+ * Description:
+ * 	Bring a mirror up to date with the remote memory and report which blocks changed.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	mirror				The mirror.
+ * 	changes			out	On return, the changed ranges, sorted by offset, with
+ * 					adjacent changed blocks merged. The array is owned by the
+ * 					mirror and is valid until the next sync. May be NULL.
+ * 	change_count		out	On return, the number of changed ranges. May be NULL.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	The remote range is captured with threadexec_snapshot_region, so unchanged blocks are
+ * 	compared in place against a copy-on-write mapping and only changed blocks are copied into
+ * 	the mirror. If the snapshot fails, the whole range is read instead.
+ */
+bool threadexec_mirror_sync(threadexec_t threadexec, threadexec_mirror_t mirror,
+		const struct threadexec_mirror_change **changes, size_t *change_count);
+
+/*
+ * threadexec_mirror_free
+ *
+ * Description:
+ * 	Free a mirror created by threadexec_mirror_create.
+ */
+void threadexec_mirror_free(threadexec_mirror_t mirror);
+
+/*
+ * threadexec_vm_region
+ *
+ * Description:
+ * 	A region of virtual memory in the remote task.
+ */
+struct threadexec_vm_region {
+	// The start address of the region.
+	const void *address;
+	// The size of the region.
+	size_t size;
+	// The current protection of the region.
+	vm_prot_t protection;
+	// The maximum protection of the region.
+	vm_prot_t max_protection;
+	// The user tag (VM_MEMORY_*) of the region.
+	unsigned user_tag;
+};
+
+/*
+ * threadexec_vm_regions
+ *
+ * Description:
+ * 	Get a sorted map of the virtual memory regions in the remote task. The map is cached.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	refresh				If true, rebuild the map even if one is cached.
+ * 	regions			out	On return, the regions, sorted by address. The array is
+ * 					owned by the threadexec context and is valid until the map is
+ * 					next refreshed or discarded.
+ * 	count			out	On return, the number of regions.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	The map is built with mach_vm_region_recurse, directly with the task API or with one remote
+ * 	call per region with the thread API. Submaps are descended into, so only leaf regions are
+ * 	reported.
+ *
+ * 	Once a map is cached, threadexec_read and threadexec_write check remote ranges against it
+ * 	and fail without touching the remote task if the range is not mapped with the needed
+ * 	protection. A range that fails the check is refreshed once before being rejected, so new
+ * 	mappings are picked up automatically. The read cache also stops read-ahead at the end of
+ * 	the mapped range.
+ */
+bool threadexec_vm_regions(threadexec_t threadexec, bool refresh,
+		const struct threadexec_vm_region **regions, size_t *count);
+
+/*
+ * threadexec_vm_regions_refresh
+ *
+ * Description:
+ * 	Refresh the cached region map over a range of the remote address space. If no map is
+ * 	cached, the whole map is built.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The start of the range to refresh.
+ * 	size				The size of the range to refresh.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool threadexec_vm_regions_refresh(threadexec_t threadexec, const void *remote_address,
+		size_t size);
+
+/*
+ * threadexec_vm_region_lookup
+ *
+ * Description:
+ * 	Find the region in the cached region map containing a remote address, building the map if
+ * 	necessary.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote address.
+ * 	region			out	On return, the region containing the address.
+ *
+ * Returns:
+ * 	Returns true if the address is mapped.
+ */
+bool threadexec_vm_region_lookup(threadexec_t threadexec, const void *remote_address,
+		struct threadexec_vm_region *region);
+
+/*
+ * threadexec_vm_regions_discard
+ *
+ * Description:
+ * 	Discard the cached region map. Remote ranges are no longer checked by threadexec_read and
+ * 	threadexec_write.
+ */
+void threadexec_vm_regions_discard(threadexec_t threadexec);
+
+// The kinds of access that trigger a watchpoint.
+enum {
+	TX_WATCH_READ  = 0x1,
+	TX_WATCH_WRITE = 0x2,
+};
+
+/*
+ * threadexec_watchpoint
+ *
+ * Description:
+ * 	A remote address to watch with threadexec_watch.
+ */
+struct threadexec_watchpoint {
+	// The remote address to watch. Must be aligned to the size.
+	const void *remote_address;
+	// The number of bytes to watch: 1, 2, 4, or 8.
+	size_t size;
+	// The accesses to watch for: TX_WATCH_READ, TX_WATCH_WRITE, or both.
+	unsigned access;
+};
+
+/*
+ * threadexec_watch_hit
+ *
+ * Description:
+ * 	A watchpoint hit reported by threadexec_watch_wait.
+ */
+struct threadexec_watch_hit {
+	// The address of the access that triggered the watchpoint.
+	const void *remote_address;
+	// The index of the watchpoint that was triggered.
+	unsigned index;
+	// The thread that made the access. The caller owns a send right to this port.
+	thread_act_t thread;
+	// The program counter of the access.
+	word_t pc;
+};
+
+/*
+ * threadexec_watch_t
+ *
+ * Description:
+ * 	An opaque type representing a set of active hardware watchpoints.
+ */
+typedef struct threadexec_watch *threadexec_watch_t;
+
+/*
+ * threadexec_watch
+ *
+ * Description:
+ * 	Set hardware watchpoints on remote addresses in every thread of the task.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	watchpoints			The watchpoints.
+ * 	count				The number of watchpoints. The hardware supports 4.
+ * 	watch			out	On return, the watch. Stop it with threadexec_watch_stop.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	The watchpoints are programmed into the debug registers of the threads that exist at the
+ * 	time of the call, except the threadexec thread itself. An exception port is installed on
+ * 	the task for EXC_BREAKPOINT; other breakpoint exceptions are passed on.
+ *
+ * 	This requires the task API.
+ */
+bool threadexec_watch(threadexec_t threadexec, const struct threadexec_watchpoint *watchpoints,
+		size_t count, threadexec_watch_t *watch);
+
+/*
+ * threadexec_watch_port
+ *
+ * Description:
+ * 	Get the exception port on which watchpoint hits arrive, for use with a dispatch source or
+ * 	port set. Use threadexec_watch_wait to handle the messages.
+ */
+mach_port_t threadexec_watch_port(threadexec_watch_t watch);
+
+/*
+ * threadexec_watch_wait
+ *
+ * Description:
+ * 	Wait for a watchpoint to be hit.
+ *
+ * Parameters:
+ * 	watch				The watch.
+ * 	timeout				The maximum time to wait, in milliseconds, or
+ * 					MACH_MSG_TIMEOUT_NONE to wait indefinitely.
+ * 	hit			out	On return, a description of the hit.
+ *
+ * Returns:
+ * 	Returns true if a watchpoint was hit, or false on timeout or error.
+ *
+ * Notes:
+ * 	The accessing thread is allowed to continue before this function returns. On arm64, where
+ * 	watchpoints fire before the access, the thread is single-stepped over the access and the
+ * 	watchpoint re-armed on a later call to threadexec_watch_wait, so keep calling it while the
+ * 	watch is active.
+ */
+bool threadexec_watch_wait(threadexec_watch_t watch, mach_msg_timeout_t timeout,
+		struct threadexec_watch_hit *hit);
+
+/*
+ * threadexec_watch_stop
+ *
+ * Description:
+ * 	Clear the watchpoints, restore the task's original exception handlers, and free the watch.
+ */
+void threadexec_watch_stop(threadexec_watch_t watch);
+
+/*
+ * threadexec_copy_between
+ *
+ * Description:
+ * 	Copy memory directly from one remote task to another.
+ *
+ * Parameters:
+ * 	source				The threadexec context of the source task.
+ * 	source_address			The remote address to copy from in the source task.
+ * 	destination			The threadexec context of the destination task.
+ * 	destination_address		The remote address to copy to in the destination task.
+ * 	size				The number of bytes to copy.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	A single window of memory is mapped into both tasks. The source thread copies data into
+ * 	the window and the destination thread copies it out, so the data never passes through
+ * 	the local task. Large copies are pipelined in 1 MB chunks, with both remote threads
+ * 	copying at the same time.
+ *
+ * 	If both contexts are the same, this is threadexec_remote_memmove.
+ */
+bool threadexec_copy_between(threadexec_t source, const void *source_address,
+		threadexec_t destination, const void *destination_address, size_t size);
+
+// The operations supported by threadexec_atomic_batch.
+enum {
+	TX_ATOMIC_LOAD,
+	TX_ATOMIC_STORE,
+	TX_ATOMIC_FETCH_ADD,
+	TX_ATOMIC_EXCHANGE,
+	TX_ATOMIC_CAS,
+};
+
+/*
+ * threadexec_atomic_op
+ *
+ * Description:
+ * 	A single atomic operation on remote memory for threadexec_atomic_batch.
+ */
+struct threadexec_atomic_op {
+	// The operation, one of TX_ATOMIC_*.
+	unsigned op;
+	// The width of the value, either 4 or 8 bytes.
+	unsigned width;
+	// The remote address of the value. Must be aligned to the width.
+	const void *remote_address;
+	// The value to store, add, or exchange, or the desired value for a compare-and-swap.
+	uint64_t value;
+	// The expected value for a compare-and-swap.
+	uint64_t expected;
+	// On return, the value before the operation.
+	uint64_t old;
+};
+
+/*
+ * threadexec_atomic_cas32
+ *
+ * Description:
+ * 	Atomically compare and swap a remote value.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	remote_address			The remote address of the value.
+ * 	expected			The value expected to be at the address.
+ * 	desired				The value to store if the expected value is present.
+ * 	old			out	On return, the value that was observed. The swap happened if
+ * 					and only if this is equal to expected.
+ *
+ * Returns:
+ * 	Returns true if the operation was performed, whether or not the swap happened.
+ *
+ * Notes:
+ * 	All of the threadexec_atomic functions run the target's own OSAtomic primitives, which
+ * 	include a full memory barrier, so they are safe to use against running threads in the
+ * 	target. Compare-and-swap and fetch-add are a single remote call. Exchange and store are
+ * 	built from a compare-and-swap loop. Loads are a plain read, which works on read-only memory
+ * 	but is not guaranteed to be single-copy atomic (see threadexec_atomic_load_acquire32);
+ * 	every other operation requires the memory to be writable.
+ */
+bool threadexec_atomic_cas32(threadexec_t threadexec, const void *remote_address,
+		uint32_t expected, uint32_t desired, uint32_t *old);
+
+/*
+ * threadexec_atomic_cas64
+ *
+ * Description:
+ * 	The 64-bit version of threadexec_atomic_cas32.
+ */
+bool threadexec_atomic_cas64(threadexec_t threadexec, const void *remote_address,
+		uint64_t expected, uint64_t desired, uint64_t *old);
+
+/*
+ * threadexec_atomic_fetch_add32
+ *
+ * Description:
+ * 	Atomically add to a remote value and return the old value. Subtract by adding the two's
+ * 	complement.
+ */
+bool threadexec_atomic_fetch_add32(threadexec_t threadexec, const void *remote_address,
+		uint32_t value, uint32_t *old);
+
+/*
+ * threadexec_atomic_fetch_add64
+ *
+ * Description:
+ * 	The 64-bit version of threadexec_atomic_fetch_add32.
+ */
+bool threadexec_atomic_fetch_add64(threadexec_t threadexec, const void *remote_address,
+		uint64_t value, uint64_t *old);
+
+/*
+ * threadexec_atomic_exchange32
+ *
+ * Description:
+ * 	Atomically replace a remote value and return the old value.
+ */
+bool threadexec_atomic_exchange32(threadexec_t threadexec, const void *remote_address,
+		uint32_t value, uint32_t *old);
+
+/*
+ * threadexec_atomic_exchange64
+ *
+ * Description:
+ * 	The 64-bit version of threadexec_atomic_exchange32.
+ */
+bool threadexec_atomic_exchange64(threadexec_t threadexec, const void *remote_address,
+		uint64_t value, uint64_t *old);
+
+/*
+ * threadexec_atomic_load_acquire32
+ *
+ * Description:
+ * 	Load a remote value with acquire ordering with respect to later threadexec operations.
+ *
+ * Notes:
+ * 	The load is a plain read, so it works on read-only memory. The read is a kernel copy or a
+ * 	remote memcpy, neither of which guarantees a single aligned load, so a value that another
+ * 	thread is changing at the same moment may be read torn. To get an atomic snapshot of a
+ * 	writable value, use threadexec_atomic_fetch_add32 with 0 instead.
+ */
+bool threadexec_atomic_load_acquire32(threadexec_t threadexec, const void *remote_address,
+		uint32_t *value);
+
+/*
+ * threadexec_atomic_load_acquire64
+ *
+ * Description:
+ * 	The 64-bit version of threadexec_atomic_load_acquire32.
+ */
+bool threadexec_atomic_load_acquire64(threadexec_t threadexec, const void *remote_address,
+		uint64_t *value);
+
+/*
+ * threadexec_atomic_store_release32
+ *
+ * Description:
+ * 	Atomically store a remote value with (at least) release ordering.
+ */
+bool threadexec_atomic_store_release32(threadexec_t threadexec, const void *remote_address,
+		uint32_t value);
+
+/*
+ * threadexec_atomic_store_release64
+ *
+ * Description:
+ * 	The 64-bit version of threadexec_atomic_store_release32.
+ */
+bool threadexec_atomic_store_release64(threadexec_t threadexec, const void *remote_address,
+		uint64_t value);
+
+/*
+ * threadexec_atomic_batch
+ *
+ * Description:
+ * 	Perform a sequence of atomic operations on remote memory, in order.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	ops			inout	The operations. On return, the old field of each operation
+ * 					is set.
+ * 	count				The number of operations.
+ *
+ * Returns:
+ * 	Returns true if every operation was performed. A failed operation does not stop the
+ * 	remaining ones.
+ *
+ * Notes:
+ * 	Each operation is individually atomic; the batch as a whole is not.
+ */
+bool threadexec_atomic_batch(threadexec_t threadexec, struct threadexec_atomic_op *ops,
+		size_t count);
+
+// The magic number at the start of a threadexec_dump_task file: "txdm".
+#define TX_DUMP_MAGIC 0x6d647874
+
+// The version of the threadexec_dump_task file format.
+#define TX_DUMP_VERSION 1
+
+/*
+ * threadexec_dump_header
+ *
+ * Description:
+ * 	The header at the start of a file written by threadexec_dump_task. All fields are in the
+ * 	byte order of the dumping machine.
+ */
+struct threadexec_dump_header {
+	// TX_DUMP_MAGIC.
+	uint32_t magic;
+	// TX_DUMP_VERSION.
+	uint32_t version;
+	// The number of entries in the region table.
+	uint64_t region_count;
+	// The file offset of the region table, an array of struct threadexec_dump_region.
+	uint64_t region_table_offset;
+};
+
+/*
+ * threadexec_dump_region
+ *
+ * Description:
+ * 	An entry in the region table of a file written by threadexec_dump_task. There is one entry
+ * 	for every region in the remote task, including the ones whose contents were skipped.
+ */
+struct threadexec_dump_region {
+	// The start address of the region in the remote task.
+	uint64_t address;
+	// The size of the region.
+	uint64_t size;
+	// The file offset of the region's contents. Page aligned. Zero if no contents were
+	// dumped.
+	uint64_t file_offset;
+	// The number of bytes at the start of the region that were dumped. Less than size if the
+	// region is unreadable or a read failed partway.
+	uint64_t dumped_size;
+	// The protection of the region.
+	int32_t protection;
+	// The maximum protection of the region.
+	int32_t max_protection;
+	// The user tag (VM_MEMORY_*) of the region.
+	uint32_t user_tag;
+	// Reserved, zero.
+	uint32_t reserved;
+};
+
+/*
+ * threadexec_dump_progress
+ *
+ * Description:
+ * 	Progress counters for threadexec_dump_task. The counters are updated as the dump proceeds
+ * 	and may be polled from another thread.
+ */
+struct threadexec_dump_progress {
+	// The number of regions in the remote task.
+	volatile size_t regions_total;
+	// The number of regions processed so far.
+	volatile size_t regions_done;
+	// The number of readable bytes that will be dumped.
+	volatile size_t bytes_total;
+	// The number of bytes dumped so far.
+	volatile size_t bytes_done;
+	// The number of bytes skipped because they were unreadable or could not be read.
+	volatile size_t bytes_skipped;
+};
+
+/*
+ * threadexec_dump_task
+ *
+ * Description:
+ * 	Write the contents of every readable region of the remote task to a core-style file.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	path				The local path of the dump file. The file is created or
+ * 					truncated.
+ * 	progress		out	The progress counters, updated during the dump. May be NULL.
+ *
+ * Returns:
+ * 	Returns true if the dump file was written. Regions that could not be read are recorded in
+ * 	the region table with a short dumped_size rather than failing the dump.
+ *
+ * Notes:
+ * 	The file starts with a struct threadexec_dump_header, followed by the region table and then
+ * 	the contents of each region at a page-aligned offset. Regions without read protection,
+ * 	including guard pages, are listed in the table but not dumped, and leave no data in the
+ * 	file.
+ *
+ * 	The file is written through a bounded window that is mapped into the local task, so local
+ * 	memory use does not depend on the size of the target. Remote memory is always read with
+ * 	threadexec_read_safe, so a page that can't be read or that becomes unmapped during the
+ * 	dump is recorded as a short region instead of crashing the target. With the task API the
+ * 	kernel copies straight into the mapped file. With only the thread API, every 16K staging
+ * 	buffer costs a remote call, so the dump runs well below memory bandwidth.
+ *
+ * 	The target keeps running during the dump, so the result is not a consistent snapshot
+ * 	unless the target is suspended by the caller.
+ */
+bool threadexec_dump_task(threadexec_t threadexec, const char *path,
+		struct threadexec_dump_progress *progress);
+
+/*
+ * threadexec_scan_pattern
+ *
+ * Description:
+ * 	A byte pattern to search for with threadexec_scan.
+ */
+struct threadexec_scan_pattern {
+	// The local bytes of the pattern.
+	const void *data;
+	// The size of the pattern. Must be nonzero.
+	size_t size;
+};
+
+/*
+ * threadexec_scan_hit
+ *
+ * Description:
+ * 	A match found by threadexec_scan.
+ */
+struct threadexec_scan_hit {
+	// The remote address of the match.
+	const void *remote_address;
+	// The index of the pattern that matched.
+	size_t pattern_index;
+	// The region containing the match.
+	struct threadexec_vm_region region;
+};
+
+/*
+ * threadexec_scan
+ *
+ * Description:
+ * 	Search every readable region of the remote task for a set of byte patterns.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	patterns			The patterns to search for.
+ * 	pattern_count			The number of patterns.
+ * 	thread_count			The number of local threads to scan with, or 0 to use one
+ * 					per CPU.
+ * 	hits			out	On return, an array of every match, sorted by address and
+ * 					then by pattern. The array must be freed with free().
+ * 	hit_count		out	On return, the number of matches.
+ *
+ * Returns:
+ * 	Returns true on success. Regions that could not be scanned are logged and skipped.
+ *
+ * Notes:
+ * 	The readable regions are snapshotted in batches with threadexec_snapshot_region, and the
+ * 	local copy-on-write views are split into chunks that are scanned in parallel. Since the
+ * 	views share pages with the target, no memory is copied.
+ * 	Regions that can't be snapshotted are searched in the remote task with
+ * 	threadexec_remote_memmem, so only the match addresses are transferred back.
+ *
+ * 	Overlapping matches are all reported. The target keeps running during the scan.
+ *
+ * 	Shared memory held by the threadexec context is not scanned. That covers the session region
+ * 	with its staging buffers and stack, the idle call_c pool regions, and the regions from
+ * 	threadexec_shared_vm_allocate, including rings and shared heaps.
+ */
+bool threadexec_scan(threadexec_t threadexec,
+		const struct threadexec_scan_pattern *patterns, size_t pattern_count,
+		unsigned thread_count, struct threadexec_scan_hit **hits, size_t *hit_count);
+
+/*
+ * threadexec_ring_t
+ *
+ * Description:
+ * 	An opaque type for a single-producer, single-consumer ring of fixed-size records in memory
+ * 	shared between the local task and the remote task.
+ */
+typedef struct threadexec_ring *threadexec_ring_t;
+
+// The message ID of a ring doorbell message.
+#define TX_RING_DOORBELL_MSG_ID 0x139a730
+
+// The size of a cache line for the purposes of separating the ring indices. This is the largest
+// cache line size on supported platforms.
+#define TX_RING_CACHE_LINE_SIZE 128
+
+/*
+ * threadexec_ring_header
+ *
+ * Description:
+ * 	The layout of the start of a ring in shared memory. Code in the remote task uses this to
+ * 	implement its end of the ring.
+ *
+ * Notes:
+ * 	The records start TX_RING_CACHE_LINE_SIZE bytes after the tail field. Records are
+ * 	numbered from 0 and record i is stored in slot (i % capacity).
+ *
+ * 	head is the number of records ever published and is only written by the producer; tail is
+ * 	the number of records ever consumed and is only written by the consumer. The ring is empty
+ * 	when head == tail and full when head - tail == capacity. The producer writes the records
+ * 	and then stores head with release ordering; the consumer loads head with acquire ordering
+ * 	before reading records. The same goes for tail in the other direction.
+ *
+ * 	If the ring has a doorbell, a consumer that wants to block sets consumer_waiting to 1,
+ * 	rechecks head, and then waits for a message with ID TX_RING_DOORBELL_MSG_ID on
+ * 	doorbell_port. After publishing, a producer that sees consumer_waiting set clears it and
+ * 	sends an empty doorbell message to doorbell_port. doorbell_port is the name of a send right
+ * 	in the remote task if the remote task produces, or of a receive right in the remote task
+ * 	if it consumes.
+ */
+struct threadexec_ring_header {
+	// The size of each record.
+	uint32_t record_size;
+	// The number of records the ring can hold. A power of 2.
+	uint32_t capacity;
+	// The doorbell port name in the remote task, or MACH_PORT_NULL if there is no doorbell.
+	uint32_t doorbell_port;
+	// Set by a consumer that is waiting for the doorbell.
+	volatile uint32_t consumer_waiting;
+	uint8_t _pad0[TX_RING_CACHE_LINE_SIZE - 16];
+	// The producer index.
+	volatile uint64_t head;
+	uint8_t _pad1[TX_RING_CACHE_LINE_SIZE - 8];
+	// The consumer index.
+	volatile uint64_t tail;
+	uint8_t _pad2[TX_RING_CACHE_LINE_SIZE - 8];
+};
+
+// Flags for threadexec_ring_create.
+enum {
+	// The local task produces records and the remote task consumes them. Otherwise the remote
+	// task produces and the local task consumes.
+	TX_RING_LOCAL_PRODUCER = 0x1,
+	// Set up a Mach message doorbell so that the consumer can block until records arrive.
+	TX_RING_DOORBELL       = 0x2,
+};
+
+/*
+ * threadexec_ring_create
+ *
+ * Description:
+ * 	Create a ring buffer in a new shared memory region.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	record_size			The size of each record.
+ * 	capacity			The number of records the ring can hold. Rounded up to a
+ * 					power of 2.
+ * 	flags				TX_RING_LOCAL_PRODUCER and TX_RING_DOORBELL.
+ * 	ring			out	On return, the ring.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	Pass the address from threadexec_ring_remote_address to the code in the remote task that
+ * 	implements the other end of the ring, following the protocol described for struct
+ * 	threadexec_ring_header.
+ *
+ * 	Each ring with a doorbell has its own Mach port, whose receive right is held by the
+ * 	consumer. The doorbell never uses the threadexec context's own ports, so a remote consumer
+ * 	blocked on it doesn't interfere with other operations.
+ */
+bool threadexec_ring_create(threadexec_t threadexec, size_t record_size, size_t capacity,
+		unsigned flags, threadexec_ring_t *ring);
+
+/*
+ * threadexec_ring_remote_address
+ *
+ * Description:
+ * 	Get the address of the ring's struct threadexec_ring_header in the remote task.
+ */
+const void *threadexec_ring_remote_address(threadexec_ring_t ring);
+
+/*
+ * threadexec_ring_publish
+ *
+ * Description:
+ * 	Publish a batch of records to a ring whose local end is the producer.
+ *
+ * Parameters:
+ * 	ring				The ring.
+ * 	records				The records to publish.
+ * 	count				The number of records.
+ *
+ * Returns:
+ * 	Returns the number of records published, which is less than count if the ring filled up.
+ *
+ * Notes:
+ * 	The records are made visible with a single release store of the producer index, and the
+ * 	doorbell is rung at most once per batch.
+ */
+size_t threadexec_ring_publish(threadexec_ring_t ring, const void *records, size_t count);
+
+/*
+ * threadexec_ring_consume
+ *
+ * Description:
+ * 	Consume a batch of records from a ring whose local end is the consumer.
+ *
+ * Parameters:
+ * 	ring				The ring.
+ * 	records			out	A buffer for up to count records.
+ * 	count				The maximum number of records to consume.
+ *
+ * Returns:
+ * 	Returns the number of records consumed, which is 0 if the ring is empty.
+ */
+size_t threadexec_ring_consume(threadexec_ring_t ring, void *records, size_t count);
+
+/*
+ * threadexec_ring_wait
+ *
+ * Description:
+ * 	Wait until a ring whose local end is the consumer has records to consume.
+ *
+ * Parameters:
+ * 	ring				The ring.
+ * 	timeout				The timeout in milliseconds, or MACH_MSG_TIMEOUT_NONE to
+ * 					wait forever.
+ *
+ * Returns:
+ * 	Returns true if records are available, or false if the wait timed out or failed.
+ *
+ * Notes:
+ * 	Without TX_RING_DOORBELL, this only checks whether records are available.
+ */
+bool threadexec_ring_wait(threadexec_ring_t ring, mach_msg_timeout_t timeout);
+
+/*
+ * threadexec_ring_free
+ *
+ * Description:
+ * 	Free a ring. The remote end must no longer be using it.
+ */
+void threadexec_ring_free(threadexec_ring_t ring);
+
+/*
+ * threadexec_stack_usage
+ *
+ * Description:
+ * 	The stack usage of calls to one remote function, as measured by stack profiling.
+ */
+struct threadexec_stack_usage {
+	// The remote function.
+	const void *function;
+	// The maximum number of bytes of stack used by any call to the function, including the
+	// space for arguments passed on the stack.
+	size_t max_depth;
+	// The number of calls measured.
+	size_t calls;
+};
+
+/*
+ * threadexec_stack_profile_enable
+ *
+ * Description:
+ * 	Start measuring how much of the remote stack each remote function call uses, discarding
+ * 	any earlier measurements.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	The stack is painted with a known pattern, and after each call the deepest point that was
+ * 	overwritten is found and repainted. This costs a scan of the stack per call, so profiling
+ * 	is meant for sizing stacks (see threadexec_init_options) rather than for production use.
+ *
+ * 	Calls that overflow the stack fault on the guard page below it. The fault is not caught, so
+ * 	it crashes the target process rather than failing the call. A call that reaches the bottom
+ * 	of the stack without faulting is logged.
+ */
+bool threadexec_stack_profile_enable(threadexec_t threadexec);
+
+/*
+ * threadexec_stack_profile_disable
+ *
+ * Description:
+ * 	Stop stack profiling and discard the measurements.
+ */
+void threadexec_stack_profile_disable(threadexec_t threadexec);
+
+/*
+ * threadexec_stack_usage
+ *
+ * Description:
+ * 	Get the stack usage measured since stack profiling was enabled.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	usage			out	On return, the usage of each function called, sorted by
+ * 					function address. The array is owned by the threadexec
+ * 					context and is valid until the next remote call. May be NULL.
+ * 	count			out	On return, the number of functions. May be NULL.
+ * 	stack_size		out	On return, the number of bytes available to the remote
+ * 					stack. May be NULL.
+ */
+void threadexec_stack_usage(threadexec_t threadexec,
+		const struct threadexec_stack_usage **usage, size_t *count, size_t *stack_size);
+
+/*
+ * threadexec_shared_heap_t
+ *
+ * Description:
+ * 	An opaque type for a heap allocator whose memory and metadata live entirely inside a shared
+ * 	memory region, so allocations are usable at their local address by the controller and at
+ * 	their remote address by code in the remote task.
+ */
+typedef struct threadexec_shared_heap *threadexec_shared_heap_t;
+
+/*
+ * threadexec_shared_heap_create
+ *
+ * Description:
+ * 	Create a shared heap in a new shared memory region.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	size				The size of the shared memory region. At most 4GB.
+ * 	heap			out	On return, the shared heap.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	Allocations are carved from the region in power-of-2 size classes from 16 bytes to 1MB,
+ * 	and freed blocks go on a lock-free free list for their class. The free lists are linked by
+ * 	offsets within the region and updated with compare-and-swap, so allocating and freeing
+ * 	never need a remote call and are safe from multiple local threads.
+ *
+ * 	The memory is shared, not copied: a store through the local address is visible at the
+ * 	remote address. Code that runs concurrently in the remote task needs its own
+ * 	synchronization to see updates in order.
+ */
+bool threadexec_shared_heap_create(threadexec_t threadexec, size_t size,
+		threadexec_shared_heap_t *heap);
+
+/*
+ * threadexec_shared_heap_destroy
+ *
+ * Description:
+ * 	Unmap a shared heap and all of its allocations. The remote task must no longer be using it.
+ */
+void threadexec_shared_heap_destroy(threadexec_shared_heap_t heap);
+
+/*
+ * threadexec_shared_heap_alloc
+ *
+ * Description:
+ * 	Allocate memory from a shared heap.
+ *
+ * Parameters:
+ * 	heap				The shared heap.
+ * 	size				The number of bytes to allocate. At most 1MB minus 16 bytes.
+ * 	local_address		out	On return, the local address of the allocation.
+ * 	remote_address		out	On return, the remote address of the allocation. May be
+ * 					NULL.
+ *
+ * Returns:
+ * 	Returns true on success, or false if the heap is exhausted.
+ *
+ * Notes:
+ * 	Allocations are 16-byte aligned. The contents of a new allocation are undefined.
+ */
+bool threadexec_shared_heap_alloc(threadexec_shared_heap_t heap, size_t size,
+		void **local_address, const void **remote_address);
+
+/*
+ * threadexec_shared_heap_free
+ *
+ * Description:
+ * 	Free an allocation from a shared heap, given its local address.
+ */
+void threadexec_shared_heap_free(threadexec_shared_heap_t heap, void *local_address);
+
+/*
+ * threadexec_shared_heap_remote_address
+ *
+ * Description:
+ * 	Translate the local address of an allocation in a shared heap to its remote address.
+ */
+const void *threadexec_shared_heap_remote_address(threadexec_shared_heap_t heap,
+		const void *local_address);
+
+/*
+ * threadexec_shared_heap_local_address
+ *
+ * Description:
+ * 	Translate a remote address in a shared heap to its local address. Returns NULL if the
+ * 	address is not in the heap.
+ */
+void *threadexec_shared_heap_local_address(threadexec_shared_heap_t heap,
+		const void *remote_address);
+
 /*
  * threadexec_mach_port_extract
  *
@@ -177,10 +177,10 @@ find_blr_x19() {
 	return blr_x19;
 }
 
-// Some code common to both thread_call_arm64 routines.
+// Set the thread state and start the thread running. The thread will infinite loop on a
+// 'blr x19' gadget once the function returns.
 static bool
-set_state_run_thread_wait_and_stop_thread(const char *_func,
-		thread_act_t thread, arm_thread_state64_t *state) {
+set_state_and_run_thread(const char *_func, thread_act_t thread, arm_thread_state64_t *state) {
 	// We need a stop condition. We'll just have the thread infinite loop on a 'blr x19' gadget
 	// once the function returns.
 	// NOTE: We could also make the thread crash on completion and set ourselves up as the
@@ -201,7 +201,16 @@ set_state_run_thread_wait_and_stop_thread(const char *_func,
 		ERROR("%s: Failed to resume thread %x", _func, thread);
 		return false;
 	}
+	return true;
+}
+
+// Wait for a thread started with set_state_and_run_thread() to reach the 'blr x19' gadget and
+// then suspend it.
+static bool
+wait_and_stop_thread(const char *_func, thread_act_t thread, arm_thread_state64_t *state) {
+	uint64_t blr_x19 = find_blr_x19();
 	// Wait until the thread is in the expected state.
+	bool success;
 	for (;;) {
 		success = thread_get_state_arm64(thread, state);
 		if (!success) {
@@ -222,6 +231,14 @@ set_state_run_thread_wait_and_stop_thread(const char *_func,
 	return true;
 }
 
+// Some code common to both thread_call_arm64 routines.
+static bool
+set_state_run_thread_wait_and_stop_thread(const char *_func,
+		thread_act_t thread, arm_thread_state64_t *state) {
+	return set_state_and_run_thread(_func, thread, state)
+		&& wait_and_stop_thread(_func, thread, state);
+}
+
 #define REGISTER_ARGUMENT_COUNT 8
 
 bool
@@ -313,10 +330,10 @@ lay_out_arguments(uint64_t *registers, void *stack, size_t stack_size,
 	return (i == argument_count);
 }
 
-bool
-thread_call_stack_arm64(thread_act_t thread,
+// Lay out the arguments for a stack-based function call and start the thread running.
+static bool
+start_thread_call_stack(const char *_func, thread_act_t thread,
 		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
-		void *result, size_t result_size,
 		word_t function, unsigned argument_count,
 		const struct threadexec_call_argument *arguments) {
 	// Get the blr x19 gadget we'll need for later.
@@ -334,12 +351,12 @@ thread_call_stack_arm64(thread_act_t thread,
 	}
 	// Now make sure we have the gadget.
 	if (blr_x19 == 0) {
-		ERROR("%s: Could not locate 'blr x19' gadget!", __func__);
+		ERROR("%s: Could not locate 'blr x19' gadget!", _func);
 		return false;
 	}
 	// And now make sure the arguments will work.
 	if (!args_ok) {
-		ERROR("%s: Unsupported number of arguments: %zu", __func__, argument_count);
+		ERROR("%s: Unsupported number of arguments: %zu", _func, argument_count);
 		return false;
 	}
 	// Set the values of the registers to execute our function call. We set registers x0
@@ -352,8 +369,39 @@ thread_call_stack_arm64(thread_act_t thread,
 	}
 	state.__sp = remote_stack;
 	state.__pc = function;
-	// Alright, now do the actual execution.
-	bool success = set_state_run_thread_wait_and_stop_thread(__func__, thread, &state);
+	// Alright, now start the execution.
+	return set_state_and_run_thread(_func, thread, &state);
+}
+
+bool
+thread_call_stack_arm64(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		void *result, size_t result_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments) {
+	bool success = start_thread_call_stack(__func__, thread,
+			local_stack_base, remote_stack_base, stack_size,
+			function, argument_count, arguments);
+	if (!success || function == 0) {
+		return success;
+	}
+	return thread_call_wait_arm64(thread, result, result_size);
+}
+
+bool
+thread_call_stack_async_arm64(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments) {
+	return start_thread_call_stack(__func__, thread,
+			local_stack_base, remote_stack_base, stack_size,
+			function, argument_count, arguments);
+}
+
+bool
+thread_call_wait_arm64(thread_act_t thread, void *result, size_t result_size) {
+	arm_thread_state64_t state;
+	bool success = wait_and_stop_thread(__func__, thread, &state);
 	if (!success) {
 		return false;
 	}
@@ -0,0 +1,132 @@
+#include "arm64/thread_debug_arm64.h"
+
+#include "tx_log.h"
+
+#include <mach/thread_status.h>
+
+// The number of watchpoint register pairs implemented by all current Apple cores.
+#define WATCHPOINT_COUNT	4
+
+// DBGWCR fields.
+#define WCR_ENABLE		(1 << 0)
+#define WCR_PAC_EL0		(2 << 1)
+#define WCR_LSC_LOAD		(1 << 3)
+#define WCR_LSC_STORE		(2 << 3)
+#define WCR_BAS_SHIFT		5
+
+// MDSCR_EL1 software step enable.
+#define MDSCR_SS		(1 << 0)
+
+// The exception code for a watchpoint hit.
+#define EXC_ARM_DA_DEBUG	0x102
+
+static bool
+get_debug_state(thread_act_t thread, arm_debug_state64_t *state) {
+	mach_msg_type_number_t count = ARM_DEBUG_STATE64_COUNT;
+	kern_return_t kr = thread_get_state(thread, ARM_DEBUG_STATE64,
+			(thread_state_t) state, &count);
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "%s: thread_get_state(0x%x): %u", __func__, thread, kr);
+		return false;
+	}
+	return true;
+}
+
+static bool
+set_debug_state(thread_act_t thread, arm_debug_state64_t *state) {
+	kern_return_t kr = thread_set_state(thread, ARM_DEBUG_STATE64,
+			(thread_state_t) state, ARM_DEBUG_STATE64_COUNT);
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "%s: thread_set_state(0x%x): %u", __func__, thread, kr);
+		return false;
+	}
+	return true;
+}
+
+// Fill in the watchpoint registers. A watchpoint covers the bytes selected by BAS within the
+// aligned doubleword at WVR.
+static void
+fill_watchpoints(arm_debug_state64_t *state,
+		const struct thread_watchpoint *watchpoints, unsigned count) {
+	for (unsigned i = 0; i < WATCHPOINT_COUNT; i++) {
+		state->__wvr[i] = 0;
+		state->__wcr[i] = 0;
+		if (i >= count) {
+			continue;
+		}
+		const struct thread_watchpoint *wp = &watchpoints[i];
+		uint64_t bas = ((1 << wp->size) - 1) << (wp->address & 7);
+		state->__wvr[i] = wp->address & ~(uint64_t) 7;
+		state->__wcr[i] = WCR_ENABLE | WCR_PAC_EL0 | (bas << WCR_BAS_SHIFT)
+			| (wp->read ? WCR_LSC_LOAD : 0) | (wp->write ? WCR_LSC_STORE : 0);
+	}
+}
+
+unsigned
+thread_watchpoint_count_arm64() {
+	return WATCHPOINT_COUNT;
+}
+
+bool
+thread_set_watchpoints_arm64(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count) {
+	arm_debug_state64_t state;
+	bool ok = get_debug_state(thread, &state);
+	if (!ok) {
+		return false;
+	}
+	fill_watchpoints(&state, watchpoints, count);
+	return set_debug_state(thread, &state);
+}
+
+bool
+thread_watchpoint_decode_arm64(thread_act_t thread, const int64_t *code,
+		unsigned code_count, word_t *address) {
+	if (code_count < 2 || code[0] != EXC_ARM_DA_DEBUG) {
+		return false;
+	}
+	*address = code[1];
+	return true;
+}
+
+bool
+thread_watchpoint_step_begin_arm64(thread_act_t thread) {
+	// The watchpoint fires before the access, so the thread would just hit it again. Disable
+	// the watchpoints and single-step the access instead.
+	arm_debug_state64_t state;
+	bool ok = get_debug_state(thread, &state);
+	if (!ok) {
+		return false;
+	}
+	for (unsigned i = 0; i < WATCHPOINT_COUNT; i++) {
+		state.__wcr[i] &= ~(uint64_t) WCR_ENABLE;
+	}
+	state.__mdscr_el1 |= MDSCR_SS;
+	return set_debug_state(thread, &state);
+}
+
+bool
+thread_watchpoint_step_end_arm64(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count) {
+	arm_debug_state64_t state;
+	bool ok = get_debug_state(thread, &state);
+	if (!ok) {
+		return false;
+	}
+	fill_watchpoints(&state, watchpoints, count);
+	state.__mdscr_el1 &= ~(uint64_t) MDSCR_SS;
+	return set_debug_state(thread, &state);
+}
+
+bool
+thread_get_pc_arm64(thread_act_t thread, word_t *pc) {
+	arm_thread_state64_t state;
+	mach_msg_type_number_t count = ARM_THREAD_STATE64_COUNT;
+	kern_return_t kr = thread_get_state(thread, ARM_THREAD_STATE64,
+			(thread_state_t) &state, &count);
+	if (kr != KERN_SUCCESS) {
+		return false;
+	}
+	*pc = state.__pc;
+	return true;
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_CALL__ARM64__THREAD_DEBUG_ARM64_H_
+#define THREAD_CALL__ARM64__THREAD_DEBUG_ARM64_H_
+
+#include "thread_debug.h"
+
+/*
+ * thread_watchpoint_count_arm64
+ *
+ * Description:
+ * 	The thread_watchpoint_count implementation for arm64.
+ */
+unsigned thread_watchpoint_count_arm64(void);
+
+/*
+ * thread_set_watchpoints_arm64
+ *
+ * Description:
+ * 	The thread_set_watchpoints implementation for arm64.
+ */
+bool thread_set_watchpoints_arm64(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count);
+
+/*
+ * thread_watchpoint_decode_arm64
+ *
+ * Description:
+ * 	The thread_watchpoint_decode implementation for arm64.
+ */
+bool thread_watchpoint_decode_arm64(thread_act_t thread, const int64_t *code,
+		unsigned code_count, word_t *address);
+
+/*
+ * thread_watchpoint_step_begin_arm64
+ *
+ * Description:
+ * 	The thread_watchpoint_step_begin implementation for arm64.
+ */
+bool thread_watchpoint_step_begin_arm64(thread_act_t thread);
+
+/*
+ * thread_watchpoint_step_end_arm64
+ *
+ * Description:
+ * 	The thread_watchpoint_step_end implementation for arm64.
+ */
+bool thread_watchpoint_step_end_arm64(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count);
+
+/*
+ * thread_get_pc_arm64
+ *
+ * Description:
+ * 	The thread_get_pc implementation for arm64.
+ */
+bool thread_get_pc_arm64(thread_act_t thread, word_t *pc);
+
+#endif
@@ -37,10 +37,11 @@ static bool
 initialize_shared_memory(threadexec_t threadexec) {
 	bool success = false;
 	// First allocate the memory.
-	const size_t shmem_size = TX_SHARED_MEMORY_SIZE;
+	const size_t shmem_size = tx_init_shmem_size(threadexec);
 	void *shmem;
 	const void *shmem_remote;
-	bool ok = threadexec_shared_vm_allocate(threadexec, &shmem_remote, &shmem, shmem_size);
+	unsigned flags = (threadexec->shmem_options.superpages ? TX_SHARED_VM_SUPERPAGE : 0);
+	bool ok = tx_shared_vm_allocate(threadexec, &shmem_remote, &shmem, shmem_size, flags);
 	if (!ok) {
 		ERROR("Could not create shared memory region");
 		goto fail_0;
@@ -7,6 +7,7 @@
 #include "tx_log.h"
 #include "tx_params.h"
 #include "tx_prototypes.h"
+#include "tx_utils.h"
 #include "thread_api/tx_stage0_mach_ports.h"
 #include "thread_api/tx_stage0_read_write.h"
 
@@ -133,19 +134,31 @@ bool
 tx_stage1_init_shared_memory(threadexec_t threadexec) {
 	bool success = false;
 	// First allocate the memory.
-	const size_t shmem_size = TX_SHARED_MEMORY_SIZE;
+	const size_t shmem_size = tx_init_shmem_size(threadexec);
 	mach_vm_address_t shmem_address;
-	kern_return_t kr = mach_vm_allocate(mach_task_self(), &shmem_address, shmem_size,
-			VM_FLAGS_ANYWHERE);
-	if (kr != KERN_SUCCESS) {
-		ERROR_CALL(mach_vm_allocate, "%u", kr);
+	bool ok = mach_vm_allocate_local(&shmem_address, shmem_size,
+			threadexec->shmem_options.superpages);
+	if (!ok) {
 		goto fail_0;
 	}
 	threadexec->shmem      = (void *) shmem_address;
 	threadexec->shmem_size = shmem_size;
 	// Send the memory region to the remote thread.
-	bool ok = send_shared_memory(threadexec, threadexec->shmem, shmem_size,
+	ok = send_shared_memory(threadexec, threadexec->shmem, shmem_size,
 			&threadexec->shmem_remote);
+	// Superpages are a best effort, so if the region can't be shared, try regular pages.
+	if (!ok && threadexec->shmem_options.superpages) {
+		DEBUG_TRACE(1, "Could not share superpage memory; using regular pages");
+		mach_vm_deallocate(mach_task_self(), shmem_address, shmem_size);
+		threadexec->shmem = NULL;
+		ok = mach_vm_allocate_local(&shmem_address, shmem_size, false);
+		if (!ok) {
+			goto fail_0;
+		}
+		threadexec->shmem = (void *) shmem_address;
+		ok = send_shared_memory(threadexec, threadexec->shmem, shmem_size,
+				&threadexec->shmem_remote);
+	}
 	if (!ok) {
 		ERROR("Could not set up shared memory");
 		goto fail_0;
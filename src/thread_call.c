@@ -102,3 +102,56 @@ thread_call_stack(thread_act_t thread,
 			result, result_size,
 			function, argument_count, arguments);
 }
+
+bool
+thread_call_stack_async(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments) {
+	assert(argument_count <= 32);
+	typedef bool (*thread_call_async_fn)(thread_act_t,
+			void *, word_t, size_t,
+			word_t, unsigned,
+			const struct threadexec_call_argument *);
+	thread_call_async_fn impl = NULL;
+#if __arm64__
+	impl = thread_call_stack_async_arm64;
+#elif __x86_64__
+	impl = thread_call_stack_async_x86_64;
+#endif
+	if (impl == NULL) {
+		DEBUG_TRACE(1, "%s: No implementation available for this platform", __func__);
+		return false;
+	}
+	if (function != 0) {
+		bool can_call = impl(thread,
+				local_stack_base, remote_stack_base, stack_size,
+				0, argument_count, arguments);
+		if (!can_call) {
+			DEBUG_TRACE(2, "Requested thread call is not supported");
+			return false;
+		}
+	}
+	DEBUG_TRACE(2, "Starting thread call of function %llx", function);
+	return impl(thread,
+			local_stack_base, remote_stack_base, stack_size,
+			function, argument_count, arguments);
+}
+
+bool
+thread_call_wait(thread_act_t thread, void *result, size_t result_size) {
+	assert(result != NULL || result_size == 0);
+	assert(result_size <= sizeof(word_t));
+	typedef bool (*thread_call_wait_fn)(thread_act_t, void *, size_t);
+	thread_call_wait_fn impl = NULL;
+#if __arm64__
+	impl = thread_call_wait_arm64;
+#elif __x86_64__
+	impl = thread_call_wait_x86_64;
+#endif
+	if (impl == NULL) {
+		DEBUG_TRACE(1, "%s: No implementation available for this platform", __func__);
+		return false;
+	}
+	return impl(thread, result, result_size);
+}
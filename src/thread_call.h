@@ -108,4 +108,57 @@ bool thread_call_stack(thread_act_t thread,
 		word_t function, unsigned argument_count,
 		const struct threadexec_call_argument *arguments);
 
+/*
+ * thread_call_stack_async
+ *
+ * Description:
+ * 	Start a function call in the remote thread without waiting for it to complete. Arguments
+ * 	can be passed in registers or on the stack. Call thread_call_wait() to wait for the
+ * 	function to return and retrieve the result.
+ *
+ * Parameters:
+ * 	thread				The thread on which to perform the function call.
+ * 	local_stack_base		The local address of a shared memory region for the remote
+ * 					stack. This is the top address of the stack.
+ * 	remote_stack_base		The remote address of the shared stack base.
+ * 	stack_size			The number of bytes the stack can grow.
+ * 	function			The address of the remote function to execute. Pass 0 to
+ * 					test if the specified function call would be supported.
+ * 	argument_count			The number of arguments to the function.
+ * 	arguments			The array of arguments to the function.
+ *
+ * Returns:
+ * 	Returns true if the thread was successfully started.
+ *
+ * Notes:
+ * 	The thread must be suspended before this function is called. On success, the thread is
+ * 	left running and the caller must call thread_call_wait() before issuing another call on
+ * 	the same thread. The stack region must not be modified until the call completes.
+ */
+bool thread_call_stack_async(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments);
+
+/*
+ * thread_call_wait
+ *
+ * Description:
+ * 	Wait for a function call started with thread_call_stack_async() to complete.
+ *
+ * Parameters:
+ * 	thread				The thread on which the function call was started.
+ * 	result			out	On return, contains the return value of the called
+ * 					function.
+ * 	result_size			The size of the function's return value in bytes. Must be a
+ * 					power of 2 no greater than the platform word size.
+ *
+ * Returns:
+ * 	Returns true on success.
+ *
+ * Notes:
+ * 	The thread is returned in a suspended state.
+ */
+bool thread_call_wait(thread_act_t thread, void *result, size_t result_size);
+
 #endif
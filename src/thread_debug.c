@@ -0,0 +1,90 @@
+#include "thread_debug.h"
+
+#if __arm64__
+#include "arm64/thread_debug_arm64.h"
+#elif __x86_64__
+#include "x86_64/thread_debug_x86_64.h"
+#endif
+
+#include "tx_log.h"
+
+unsigned
+thread_watchpoint_count() {
+#if __arm64__
+	return thread_watchpoint_count_arm64();
+#elif __x86_64__
+	return thread_watchpoint_count_x86_64();
+#else
+	return 0;
+#endif
+}
+
+bool
+thread_set_watchpoints(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count) {
+	typedef bool (*thread_set_watchpoints_fn)(thread_act_t,
+			const struct thread_watchpoint *, unsigned);
+	thread_set_watchpoints_fn impl = NULL;
+#if __arm64__
+	impl = thread_set_watchpoints_arm64;
+#elif __x86_64__
+	impl = thread_set_watchpoints_x86_64;
+#endif
+	if (impl == NULL) {
+		DEBUG_TRACE(1, "%s: No implementation available for this platform", __func__);
+		return false;
+	}
+	return impl(thread, watchpoints, count);
+}
+
+bool
+thread_watchpoint_decode(thread_act_t thread, const int64_t *code, unsigned code_count,
+		word_t *address) {
+	typedef bool (*thread_watchpoint_decode_fn)(thread_act_t,
+			const int64_t *, unsigned, word_t *);
+	thread_watchpoint_decode_fn impl = NULL;
+#if __arm64__
+	impl = thread_watchpoint_decode_arm64;
+#elif __x86_64__
+	impl = thread_watchpoint_decode_x86_64;
+#endif
+	if (impl == NULL) {
+		return false;
+	}
+	return impl(thread, code, code_count, address);
+}
+
+bool
+thread_watchpoint_step_begin(thread_act_t thread) {
+#if __arm64__
+	return thread_watchpoint_step_begin_arm64(thread);
+#else
+	// x86_64 watchpoints are traps: the access has already completed.
+	return false;
+#endif
+}
+
+bool
+thread_watchpoint_step_end(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count) {
+#if __arm64__
+	return thread_watchpoint_step_end_arm64(thread, watchpoints, count);
+#else
+	return true;
+#endif
+}
+
+bool
+thread_get_pc(thread_act_t thread, word_t *pc) {
+	typedef bool (*thread_get_pc_fn)(thread_act_t, word_t *);
+	thread_get_pc_fn impl = NULL;
+#if __arm64__
+	impl = thread_get_pc_arm64;
+#elif __x86_64__
+	impl = thread_get_pc_x86_64;
+#endif
+	if (impl == NULL) {
+		return false;
+	}
+	return impl(thread, pc);
+}
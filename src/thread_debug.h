@@ -0,0 +1,89 @@
+#ifndef THREADEXEC__THREAD_DEBUG_H_
+#define THREADEXEC__THREAD_DEBUG_H_
+
+#include "threadexec/threadexec.h"
+
+#include <mach/mach_types.h>
+#include <stdbool.h>
+
+/*
+ * thread_watchpoint
+ *
+ * Description:
+ * 	A hardware watchpoint to program into a thread's debug registers.
+ */
+struct thread_watchpoint {
+	word_t address;
+	size_t size;
+	bool read;
+	bool write;
+};
+
+/*
+ * thread_watchpoint_count
+ *
+ * Description:
+ * 	Returns the number of hardware watchpoints that can be set on a thread, or 0 if
+ * 	watchpoints are not supported on this platform.
+ */
+unsigned thread_watchpoint_count(void);
+
+/*
+ * thread_set_watchpoints
+ *
+ * Description:
+ * 	Program the hardware watchpoints of a thread. The watchpoint slots beyond count are
+ * 	cleared, so passing a count of 0 clears all watchpoints. Any other debug state of the
+ * 	thread is left intact.
+ *
+ * Parameters:
+ * 	thread				The thread.
+ * 	watchpoints			The watchpoints. Each must be naturally aligned and 1, 2, 4,
+ * 					or 8 bytes long.
+ * 	count				The number of watchpoints. At most thread_watchpoint_count().
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool thread_set_watchpoints(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count);
+
+/*
+ * thread_watchpoint_decode
+ *
+ * Description:
+ * 	Decode an EXC_BREAKPOINT exception raised on a thread. If it was caused by a watchpoint,
+ * 	returns true and sets address to the address that was accessed.
+ */
+bool thread_watchpoint_decode(thread_act_t thread, const int64_t *code, unsigned code_count,
+		word_t *address);
+
+/*
+ * thread_watchpoint_step_begin
+ *
+ * Description:
+ * 	Prepare a thread that hit a watchpoint to continue. On platforms where the watchpoint is
+ * 	reported before the access completes, the watchpoints are disabled and the thread is set
+ * 	to single-step over the access; in that case true is returned and
+ * 	thread_watchpoint_step_end must be called when the single-step exception arrives.
+ */
+bool thread_watchpoint_step_begin(thread_act_t thread);
+
+/*
+ * thread_watchpoint_step_end
+ *
+ * Description:
+ * 	Finish stepping a thread over a watched access, re-enabling its watchpoints.
+ */
+bool thread_watchpoint_step_end(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count);
+
+/*
+ * thread_get_pc
+ *
+ * Description:
+ * 	Get the program counter of a suspended or exception-blocked thread.
+ */
+bool thread_get_pc(thread_act_t thread, word_t *pc);
+
+#endif
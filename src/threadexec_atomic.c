@@ -0,0 +1,277 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_read_cache.h"
+#include "tx_write_buffer.h"
+
+#include <assert.h>
+#include <libkern/OSAtomic.h>
+
+// The OSAtomic functions are deprecated in favor of <stdatomic.h>, but the C11 atomics are
+// compiler builtins rather than functions we could call in the remote task.
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+// Compare and swap a 4- or 8-byte value in a single remote call.
+static bool
+remote_cas(threadexec_t threadexec, word_t remote_address, unsigned width,
+		uint64_t expected, uint64_t desired, bool *swapped) {
+	struct threadexec_call_argument args[3];
+	const void *function;
+	if (width == sizeof(uint32_t)) {
+		function = OSAtomicCompareAndSwap32Barrier;
+		args[0] = TX_ARG(int32_t, expected);
+		args[1] = TX_ARG(int32_t, desired);
+	} else {
+		function = OSAtomicCompareAndSwap64Barrier;
+		args[0] = TX_ARG(int64_t, expected);
+		args[1] = TX_ARG(int64_t, desired);
+	}
+	args[2] = TX_ARG(word_t, remote_address);
+	bool ok = threadexec_call(threadexec, swapped, sizeof(*swapped), function, 3, args);
+	if (!ok) {
+		ERROR_REMOTE_CALL(OSAtomicCompareAndSwapBarrier);
+	}
+	return ok;
+}
+
+// Atomically add to a 4- or 8-byte value in a single remote call, returning the old value.
+static bool
+remote_fetch_add(threadexec_t threadexec, word_t remote_address, unsigned width,
+		uint64_t value, uint64_t *old) {
+	struct threadexec_call_argument args[2];
+	const void *function;
+	if (width == sizeof(uint32_t)) {
+		function = OSAtomicAdd32Barrier;
+		args[0] = TX_ARG(int32_t, value);
+	} else {
+		function = OSAtomicAdd64Barrier;
+		args[0] = TX_ARG(int64_t, value);
+	}
+	args[1] = TX_ARG(word_t, remote_address);
+	uint64_t result = 0;
+	bool ok = threadexec_call(threadexec, &result, width, function, 2, args);
+	if (!ok) {
+		ERROR_REMOTE_CALL(OSAtomicAddBarrier);
+		return false;
+	}
+	// OSAtomicAdd returns the new value.
+	uint64_t mask = (width == sizeof(uint32_t) ? UINT32_MAX : UINT64_MAX);
+	*old = (result - value) & mask;
+	return true;
+}
+
+// Load a value with a plain read. Unlike an atomic read-modify-write this works on read-only
+// memory and doesn't dirty copy-on-write pages, but the read is a kernel copy or a remote memcpy,
+// neither of which promises a single load: a value being changed concurrently may be read torn.
+// Every later operation starts only after the copy has finished, so no separate barrier is needed
+// to order them after it.
+static bool
+remote_load(threadexec_t threadexec, word_t remote_address, unsigned width, uint64_t *value) {
+	// Bypass the read cache, but make sure our own buffered writes have landed first.
+	bool ok = tx_write_buffer_flush_range(threadexec, remote_address, width);
+	if (!ok) {
+		return false;
+	}
+	uint32_t value32;
+	uint64_t value64;
+	ok = tx_read_direct(threadexec, remote_address,
+			(width == sizeof(uint32_t) ? (void *) &value32 : (void *) &value64), width);
+	if (!ok) {
+		ERROR("Could not read remote address %p", (void *) remote_address);
+		return false;
+	}
+	*value = (width == sizeof(uint32_t) ? value32 : value64);
+	return true;
+}
+
+// Compare and swap, returning the value that was observed. The swap happened if and only if the
+// returned value equals the expected one.
+static bool
+atomic_cas(threadexec_t threadexec, word_t remote_address, unsigned width,
+		uint64_t expected, uint64_t desired, uint64_t *old) {
+	for (;;) {
+		bool swapped;
+		bool ok = remote_cas(threadexec, remote_address, width, expected, desired,
+				&swapped);
+		if (!ok) {
+			return false;
+		}
+		if (swapped) {
+			*old = expected;
+			return true;
+		}
+		// The compare and swap doesn't tell us what it saw, so load the current value. If
+		// that now matches, the value changed back in between and we have to try again.
+		// The memory is writable, so load it by adding zero, which can't be torn.
+		ok = remote_fetch_add(threadexec, remote_address, width, 0, old);
+		if (!ok) {
+			return false;
+		}
+		if (*old != expected) {
+			return true;
+		}
+	}
+}
+
+// Exchange a value with a compare-and-swap loop, returning the old value.
+static bool
+atomic_exchange(threadexec_t threadexec, word_t remote_address, unsigned width,
+		uint64_t value, uint64_t *old) {
+	uint64_t current;
+	bool ok = remote_fetch_add(threadexec, remote_address, width, 0, &current);
+	while (ok) {
+		uint64_t observed;
+		ok = atomic_cas(threadexec, remote_address, width, current, value, &observed);
+		if (ok && observed == current) {
+			*old = current;
+			return true;
+		}
+		current = observed;
+	}
+	return false;
+}
+
+static bool
+atomic_op(threadexec_t threadexec, struct threadexec_atomic_op *op) {
+	word_t address = (word_t) op->remote_address;
+	unsigned width = op->width;
+	if (width != sizeof(uint32_t) && width != sizeof(uint64_t)) {
+		ERROR("Invalid atomic operation width %u", width);
+		return false;
+	}
+	if (address % width != 0) {
+		ERROR("Atomic operation on misaligned address %p", op->remote_address);
+		return false;
+	}
+	bool ok;
+	switch (op->op) {
+		case TX_ATOMIC_LOAD:
+			return remote_load(threadexec, address, width, &op->old);
+		case TX_ATOMIC_FETCH_ADD:
+			ok = remote_fetch_add(threadexec, address, width, op->value, &op->old);
+			break;
+		case TX_ATOMIC_EXCHANGE:
+		case TX_ATOMIC_STORE:
+			ok = atomic_exchange(threadexec, address, width, op->value, &op->old);
+			break;
+		case TX_ATOMIC_CAS:
+			ok = atomic_cas(threadexec, address, width, op->expected, op->value,
+					&op->old);
+			break;
+		default:
+			ERROR("Invalid atomic operation %u", op->op);
+			return false;
+	}
+	tx_read_cache_update(threadexec, address, NULL, width);
+	return ok;
+}
+
+bool
+threadexec_atomic_batch(threadexec_t threadexec, struct threadexec_atomic_op *ops, size_t count) {
+	bool all_ok = true;
+	for (size_t i = 0; i < count; i++) {
+		bool ok = atomic_op(threadexec, &ops[i]);
+		all_ok = all_ok && ok;
+	}
+	return all_ok;
+}
+
+// Perform a single operation.
+static bool
+single_op(threadexec_t threadexec, unsigned op_kind, unsigned width, const void *remote_address,
+		uint64_t value, uint64_t expected, uint64_t *old) {
+	struct threadexec_atomic_op op = {
+		.op             = op_kind,
+		.width          = width,
+		.remote_address = remote_address,
+		.value          = value,
+		.expected       = expected,
+	};
+	bool ok = atomic_op(threadexec, &op);
+	*old = op.old;
+	return ok;
+}
+
+bool
+threadexec_atomic_cas32(threadexec_t threadexec, const void *remote_address,
+		uint32_t expected, uint32_t desired, uint32_t *old) {
+	uint64_t old64 = 0;
+	bool ok = single_op(threadexec, TX_ATOMIC_CAS, sizeof(uint32_t), remote_address,
+			desired, expected, &old64);
+	*old = (uint32_t) old64;
+	return ok;
+}
+
+bool
+threadexec_atomic_cas64(threadexec_t threadexec, const void *remote_address,
+		uint64_t expected, uint64_t desired, uint64_t *old) {
+	return single_op(threadexec, TX_ATOMIC_CAS, sizeof(uint64_t), remote_address,
+			desired, expected, old);
+}
+
+bool
+threadexec_atomic_fetch_add32(threadexec_t threadexec, const void *remote_address,
+		uint32_t value, uint32_t *old) {
+	uint64_t old64 = 0;
+	bool ok = single_op(threadexec, TX_ATOMIC_FETCH_ADD, sizeof(uint32_t), remote_address,
+			value, 0, &old64);
+	*old = (uint32_t) old64;
+	return ok;
+}
+
+bool
+threadexec_atomic_fetch_add64(threadexec_t threadexec, const void *remote_address,
+		uint64_t value, uint64_t *old) {
+	return single_op(threadexec, TX_ATOMIC_FETCH_ADD, sizeof(uint64_t), remote_address,
+			value, 0, old);
+}
+
+bool
+threadexec_atomic_exchange32(threadexec_t threadexec, const void *remote_address,
+		uint32_t value, uint32_t *old) {
+	uint64_t old64 = 0;
+	bool ok = single_op(threadexec, TX_ATOMIC_EXCHANGE, sizeof(uint32_t), remote_address,
+			value, 0, &old64);
+	*old = (uint32_t) old64;
+	return ok;
+}
+
+bool
+threadexec_atomic_exchange64(threadexec_t threadexec, const void *remote_address,
+		uint64_t value, uint64_t *old) {
+	return single_op(threadexec, TX_ATOMIC_EXCHANGE, sizeof(uint64_t), remote_address,
+			value, 0, old);
+}
+
+bool
+threadexec_atomic_load_acquire32(threadexec_t threadexec, const void *remote_address,
+		uint32_t *value) {
+	uint64_t value64 = 0;
+	bool ok = single_op(threadexec, TX_ATOMIC_LOAD, sizeof(uint32_t), remote_address,
+			0, 0, &value64);
+	*value = (uint32_t) value64;
+	return ok;
+}
+
+bool
+threadexec_atomic_load_acquire64(threadexec_t threadexec, const void *remote_address,
+		uint64_t *value) {
+	return single_op(threadexec, TX_ATOMIC_LOAD, sizeof(uint64_t), remote_address,
+			0, 0, value);
+}
+
+bool
+threadexec_atomic_store_release32(threadexec_t threadexec, const void *remote_address,
+		uint32_t value) {
+	uint64_t old;
+	return single_op(threadexec, TX_ATOMIC_STORE, sizeof(uint32_t), remote_address,
+			value, 0, &old);
+}
+
+bool
+threadexec_atomic_store_release64(threadexec_t threadexec, const void *remote_address,
+		uint64_t value) {
+	uint64_t old;
+	return single_op(threadexec, TX_ATOMIC_STORE, sizeof(uint64_t), remote_address,
+			value, 0, &old);
+}
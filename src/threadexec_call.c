@@ -2,6 +2,7 @@
 
 #include "tx_call.h"
 #include "tx_log.h"
+#include "tx_shared_vm_pool.h"
 
 #include <assert.h>
 
@@ -26,29 +27,36 @@ threadexec_call_c(threadexec_t threadexec, void *result, size_t result_size,
 	bool success;
 	assert(argument_count <= 32);
 	struct threadexec_call_argument literal_arguments[32] = {};
+	// The remote addresses of pointer arguments whose data is already in shared memory, or 0.
+	word_t shared_data[32] = {};
 	size_t shmem_size = 0;
 	const uint8_t *shmem_remote;
 	uint8_t *shmem_local;
-	// Get the size of the shared memory region we'll need to establish.
+	// Get the size of the shared memory region we'll need to establish. Data that already
+	// lives in a shared region is passed in place, so it needs no space and no copies.
 	for (size_t i = 0; i < argument_count; i++) {
 		switch (arguments[i].disposition) {
 			case TX_DISPOSITION_PTR_DATA_IN:
 			case TX_DISPOSITION_PTR_DATA_OUT:
 			case TX_DISPOSITION_PTR_DATA_INOUT:
-				shmem_size += arguments[i].data_size;
+				if (!tx_shared_vm_translate(threadexec,
+							(const void *) arguments[i].value,
+							arguments[i].data_size, &shared_data[i])) {
+					shmem_size += arguments[i].data_size;
+				}
 				break;
 			default:
 				break;
 		}
 	}
-	// Set up the shared memory region. If it's smaller than 0x4000, just use the top of the
-	// stack.
-	if (shmem_size <= 0x4000) {
+	// Set up the shared memory region. If it fits in the staging buffers at the bottom of the
+	// stack, just use those.
+	if (shmem_size <= threadexec->staging_buffer_count * threadexec->staging_buffer_size) {
 		shmem_remote = (const uint8_t *) threadexec->shmem_remote;
 		shmem_local  = (uint8_t *) threadexec->shmem;
 	} else {
-		success = threadexec_shared_vm_allocate(threadexec, (const void **) &shmem_remote,
-				(void **) &shmem_local, shmem_size);
+		success = tx_shared_vm_pool_allocate(threadexec, shmem_size,
+				(const void **) &shmem_remote, (void **) &shmem_local);
 		if (!success) {
 			goto fail_0;
 		}
@@ -64,6 +72,10 @@ threadexec_call_c(threadexec_t threadexec, void *result, size_t result_size,
 			case TX_DISPOSITION_PTR_DATA_IN:
 			case TX_DISPOSITION_PTR_DATA_OUT:
 			case TX_DISPOSITION_PTR_DATA_INOUT:
+				if (shared_data[i] != 0) {
+					literal_arguments[i].value = shared_data[i];
+					break;
+				}
 				literal_arguments[i].value = (word_t)
 					shmem_remote + shmem_position;
 				if (disposition & TX_DISPOSITION_PTR_DATA_IN) {
@@ -92,6 +104,9 @@ threadexec_call_c(threadexec_t threadexec, void *result, size_t result_size,
 			case TX_DISPOSITION_PTR_DATA_IN:
 			case TX_DISPOSITION_PTR_DATA_OUT:
 			case TX_DISPOSITION_PTR_DATA_INOUT:
+				if (shared_data[i] != 0) {
+					break;
+				}
 				if (disposition & TX_DISPOSITION_PTR_DATA_OUT) {
 					memcpy((void *)arguments[i].value,
 							shmem_local + shmem_position,
@@ -105,7 +120,7 @@ threadexec_call_c(threadexec_t threadexec, void *result, size_t result_size,
 	}
 fail_1:
 	if (shmem_size > 0 && (word_t) shmem_remote != threadexec->shmem_remote) {
-		threadexec_shared_vm_deallocate(threadexec, shmem_remote, shmem_local, shmem_size);
+		tx_shared_vm_pool_free(threadexec, shmem_remote, shmem_local, shmem_size);
 	}
 fail_0:
 	return success;
@@ -0,0 +1,191 @@
+#include "tx_internal.h"
+
+#include "tx_call.h"
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_prototypes.h"
+#include "tx_read_cache.h"
+#include "tx_utils.h"
+#include "tx_vm_map.h"
+#include "tx_write_buffer.h"
+
+// A window of memory shared between the local task and both remote tasks. The window is split
+// into two halves so that one remote thread can fill one half while the other drains the other.
+struct copy_window {
+	mach_vm_address_t local;
+	size_t size;
+	size_t chunk_size;
+	mach_port_t memory_entry;
+	const void *source_remote;
+	const void *destination_remote;
+};
+
+static bool
+window_create(threadexec_t source, threadexec_t destination, size_t size,
+		struct copy_window *window) {
+	window->chunk_size = min(round2_up(size, (size_t) vm_page_size), TX_COPY_CHUNK_SIZE);
+	window->size       = 2 * window->chunk_size;
+	kern_return_t kr = mach_vm_allocate(mach_task_self(), &window->local, window->size,
+			VM_FLAGS_ANYWHERE);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_vm_allocate, "%u", kr);
+		goto fail_0;
+	}
+	memory_object_size_t mo_size = window->size;
+	kr = mach_make_memory_entry_64(mach_task_self(), &mo_size,
+			(memory_object_offset_t) window->local, VM_PROT_DEFAULT,
+			&window->memory_entry, MACH_PORT_NULL);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_make_memory_entry_64, "%u", kr);
+		goto fail_1;
+	}
+	bool ok = tx_shared_vm_map_entry(source, window->memory_entry, window->size, false,
+			&window->source_remote);
+	if (!ok) {
+		ERROR("Could not map copy window into %s task", "source");
+		goto fail_2;
+	}
+	ok = tx_shared_vm_map_entry(destination, window->memory_entry, window->size, false,
+			&window->destination_remote);
+	if (!ok) {
+		ERROR("Could not map copy window into %s task", "destination");
+		goto fail_3;
+	}
+	return true;
+fail_3:
+	threadexec_mach_vm_deallocate(source, window->source_remote, window->size);
+fail_2:
+	mach_port_deallocate(mach_task_self(), window->memory_entry);
+fail_1:
+	mach_vm_deallocate(mach_task_self(), window->local, window->size);
+fail_0:
+	return false;
+}
+
+static void
+window_destroy(threadexec_t source, threadexec_t destination, struct copy_window *window) {
+	threadexec_mach_vm_deallocate(destination, window->destination_remote, window->size);
+	threadexec_mach_vm_deallocate(source, window->source_remote, window->size);
+	mach_port_deallocate(mach_task_self(), window->memory_entry);
+	mach_vm_deallocate(mach_task_self(), window->local, window->size);
+}
+
+// Start a remote copy without waiting for it. In safe mode the kernel does the copy, with any
+// output parameter pointed at the first staging buffer.
+static bool
+start_copy(threadexec_t threadexec, word_t destination, word_t source, size_t size,
+		bool into_window) {
+	if (threadexec->flags & TX_SAFE_MEMORY_ACCESS) {
+		if (into_window) {
+			struct threadexec_call_argument args[5] = {
+				TX_ARG(vm_map_t,           threadexec->task_remote),
+				TX_ARG(mach_vm_address_t,  source),
+				TX_ARG(mach_vm_size_t,     size),
+				TX_ARG(mach_vm_address_t,  destination),
+				TX_ARG(mach_vm_size_t *,   threadexec->staging_remote),
+			};
+			return tx_call_async(threadexec, (word_t) mach_vm_read_overwrite, 5, args);
+		} else {
+			struct threadexec_call_argument args[4] = {
+				TX_ARG(vm_map_t,               threadexec->task_remote),
+				TX_ARG(mach_vm_address_t,      destination),
+				TX_ARG(vm_offset_t,            source),
+				TX_ARG(mach_msg_type_number_t, size),
+			};
+			return tx_call_async(threadexec, (word_t) mach_vm_write, 4, args);
+		}
+	}
+	struct threadexec_call_argument memcpy_args[3] = {
+		TX_ARG(void *,       destination),
+		TX_ARG(const void *, source),
+		TX_ARG(size_t,       size),
+	};
+	return tx_call_async(threadexec, (word_t) memcpy, 3, memcpy_args);
+}
+
+static bool
+finish_copy(threadexec_t threadexec) {
+	kern_return_t kr = KERN_SUCCESS;
+	bool safe = (threadexec->flags & TX_SAFE_MEMORY_ACCESS) != 0;
+	bool ok = tx_call_wait(threadexec, (safe ? &kr : NULL), (safe ? sizeof(kr) : 0));
+	if (!ok) {
+		return false;
+	}
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "Remote copy failed: %u", kr);
+		return false;
+	}
+	return true;
+}
+
+bool
+threadexec_copy_between(threadexec_t source, const void *source_address,
+		threadexec_t destination, const void *destination_address, size_t size) {
+	if (source == destination) {
+		return threadexec_remote_memmove(source, destination_address, source_address, size);
+	}
+	if (size == 0) {
+		return true;
+	}
+	word_t src = (word_t) source_address;
+	word_t dst = (word_t) destination_address;
+	// Pending writes on either side must land first.
+	bool ok = tx_write_buffer_flush_range(source, src, size)
+		&& tx_write_buffer_flush_range(destination, dst, size);
+	if (!ok) {
+		return false;
+	}
+	if (!tx_vm_map_check(source, src, size, VM_PROT_READ, true)
+			|| !tx_vm_map_check(destination, dst, size, VM_PROT_WRITE, true)) {
+		ERROR("Copy from %p to %p is not to mapped memory", source_address,
+				destination_address);
+		return false;
+	}
+	struct copy_window window;
+	ok = window_create(source, destination, size, &window);
+	if (!ok) {
+		return false;
+	}
+	// Step i copies chunk i into one half of the window in the source task while the
+	// destination task copies chunk i - 1 out of the other half. The two remote threads run
+	// concurrently.
+	const size_t chunk_size  = window.chunk_size;
+	const size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+	size_t done = 0;
+	for (size_t i = 0; ok && i <= chunk_count; i++) {
+		bool copy_in  = (i < chunk_count);
+		bool copy_out = (i > 0);
+		size_t in_offset  = i * chunk_size;
+		size_t out_offset = (i - 1) * chunk_size;
+		bool in_started = false, out_started = false;
+		if (copy_in) {
+			word_t half = (word_t) window.source_remote + (i % 2) * chunk_size;
+			in_started = start_copy(source, half, src + in_offset,
+					min(size - in_offset, chunk_size), true);
+			ok = in_started;
+		}
+		if (ok && copy_out) {
+			word_t half = (word_t) window.destination_remote
+				+ ((i - 1) % 2) * chunk_size;
+			out_started = start_copy(destination, dst + out_offset, half,
+					min(size - out_offset, chunk_size), false);
+			ok = out_started;
+		}
+		if (in_started) {
+			ok = finish_copy(source) && ok;
+		}
+		if (out_started) {
+			bool out_ok = finish_copy(destination);
+			if (out_ok) {
+				done += min(size - out_offset, chunk_size);
+			}
+			ok = out_ok && ok;
+		}
+	}
+	window_destroy(source, destination, &window);
+	tx_read_cache_update(destination, dst, NULL, size);
+	if (done != size) {
+		ERROR("Remote-to-remote copy failed with %zu bytes left", size - done);
+	}
+	return (done == size);
+}
@@ -0,0 +1,170 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The alignment of region contents in the dump file. This is a multiple of the page size on every
+// platform, so a window of the file can be mapped at any region's offset.
+#define DUMP_ALIGNMENT 0x4000
+
+struct dump_state {
+	struct threadexec_dump_progress *progress;
+};
+
+// Write a whole buffer to a file at an offset.
+static bool
+pwrite_all(int fd, const void *data, size_t size, off_t offset) {
+	const uint8_t *p = data;
+	while (size > 0) {
+		ssize_t written = pwrite(fd, p, size, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ERROR_CALL(pwrite, "%d", errno);
+			return false;
+		}
+		p      += written;
+		size   -= written;
+		offset += written;
+	}
+	return true;
+}
+
+// Read one window's worth of a region into the file. Returns the number of bytes that were read
+// from the start of the window.
+static size_t
+dump_window(threadexec_t threadexec, int fd, struct dump_state *state, word_t remote_address,
+		size_t size, uint64_t file_offset) {
+	void *window = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, file_offset);
+	if (window == MAP_FAILED) {
+		ERROR_CALL(mmap, "%d", errno);
+		return 0;
+	}
+	// The kernel does the copies, so a page that is mapped but can't be read, or that was
+	// unmapped since the regions were enumerated, ends the window with an error rather than
+	// crashing the target. With the task API the copy goes straight into the file's pages;
+	// otherwise it goes through the staging buffers.
+	size_t read_size = 0;
+	threadexec_read_safe(threadexec, (const void *) remote_address, window, size, &read_size);
+	state->progress->bytes_done += read_size;
+	// Start writeback now so that dirty pages don't pile up in memory over a large dump.
+	msync(window, size, MS_ASYNC);
+	munmap(window, size);
+	return read_size;
+}
+
+// Dump the contents of a region to its place in the file.
+static void
+dump_region(threadexec_t threadexec, int fd, struct dump_state *state,
+		struct threadexec_dump_region *entry) {
+	uint64_t dumped = 0;
+	while (dumped < entry->size) {
+		size_t window_size = min(entry->size - dumped, (uint64_t) TX_DUMP_WINDOW_SIZE);
+		size_t read_size = dump_window(threadexec, fd, state, entry->address + dumped,
+				window_size, entry->file_offset + dumped);
+		dumped += read_size;
+		if (read_size < window_size) {
+			ERROR("Could not dump remote region %p-%p past %p",
+					(void *) entry->address,
+					(void *) (entry->address + entry->size),
+					(void *) (entry->address + dumped));
+			break;
+		}
+	}
+	entry->dumped_size = dumped;
+	state->progress->bytes_skipped += entry->size - dumped;
+}
+
+bool
+threadexec_dump_task(threadexec_t threadexec, const char *path,
+		struct threadexec_dump_progress *progress) {
+	bool success = false;
+	struct threadexec_dump_progress local_progress;
+	if (progress == NULL) {
+		progress = &local_progress;
+	}
+	memset((void *) progress, 0, sizeof(*progress));
+	// Get a fresh region map and copy it, since the cached map may be refreshed by the reads.
+	const struct threadexec_vm_region *regions;
+	size_t count;
+	bool ok = threadexec_vm_regions(threadexec, true, &regions, &count);
+	if (!ok) {
+		ERROR("Could not enumerate remote memory regions");
+		goto fail_0;
+	}
+	struct threadexec_dump_region *table = calloc(count, sizeof(*table));
+	assert(count == 0 || table != NULL);
+	// Lay out the file: the header, the region table, and then the contents of each readable
+	// region. Unreadable regions, including guard pages, take no space.
+	size_t table_size = count * sizeof(*table);
+	uint64_t file_offset = round2_up(sizeof(struct threadexec_dump_header) + table_size,
+			DUMP_ALIGNMENT);
+	for (size_t i = 0; i < count; i++) {
+		const struct threadexec_vm_region *region = &regions[i];
+		struct threadexec_dump_region *entry = &table[i];
+		entry->address        = (word_t) region->address;
+		entry->size           = region->size;
+		entry->protection     = region->protection;
+		entry->max_protection = region->max_protection;
+		entry->user_tag       = region->user_tag;
+		if (region->protection & VM_PROT_READ) {
+			entry->file_offset = file_offset;
+			file_offset += round2_up(region->size, DUMP_ALIGNMENT);
+			progress->bytes_total += region->size;
+		}
+	}
+	progress->regions_total = count;
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		ERROR_CALL(open, "%d", errno);
+		goto fail_1;
+	}
+	// Size the file up front so that windows can be mapped anywhere in it. Anything we don't
+	// write stays a hole.
+	int err = ftruncate(fd, file_offset);
+	if (err != 0) {
+		ERROR_CALL(ftruncate, "%d", errno);
+		goto fail_2;
+	}
+	struct dump_state state = { .progress = progress };
+	for (size_t i = 0; i < count; i++) {
+		struct threadexec_dump_region *entry = &table[i];
+		if (entry->file_offset != 0) {
+			dump_region(threadexec, fd, &state, entry);
+		} else {
+			DEBUG_TRACE(2, "Skipping unreadable region %p-%p", (void *) entry->address,
+					(void *) (entry->address + entry->size));
+		}
+		progress->regions_done = i + 1;
+	}
+	// Write the header and region table last, once the dumped sizes are known.
+	struct threadexec_dump_header header = {
+		.magic               = TX_DUMP_MAGIC,
+		.version             = TX_DUMP_VERSION,
+		.region_count        = count,
+		.region_table_offset = sizeof(header),
+	};
+	ok = pwrite_all(fd, &header, sizeof(header), 0)
+		&& pwrite_all(fd, table, table_size, sizeof(header));
+	if (!ok) {
+		goto fail_2;
+	}
+	DEBUG_TRACE(1, "Dumped %zu of %zu bytes in %zu regions to %s", progress->bytes_done,
+			progress->bytes_total, count, path);
+	success = true;
+fail_2:
+	close(fd);
+fail_1:
+	free(table);
+fail_0:
+	return success;
+}
@@ -0,0 +1,220 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+struct threadexec_graph {
+	size_t node_size;
+	size_t node_count;
+	// The local copies of the nodes, in breadth-first order.
+	uint8_t *arena;
+	// The remote address of each node.
+	word_t *remote;
+	// An open-addressed hash table from remote address to node index + 1. Zero marks an empty
+	// slot.
+	size_t *index;
+	size_t index_mask;
+	// An open-addressed set of the remote addresses that could not be read, using the same
+	// slot count as the index, so that a pointer to unreadable memory is only tried once.
+	// Zero marks an empty slot. At most max_nodes addresses are recorded to keep the set at
+	// most half full.
+	word_t *unreadable;
+	size_t unreadable_count;
+	size_t max_nodes;
+};
+
+static size_t
+index_slot(const struct threadexec_graph *graph, word_t remote_address) {
+	return (size_t) ((remote_address * 0x9e3779b97f4a7c15) >> 32) & graph->index_mask;
+}
+
+// Find the index of the node with the given remote address, or -1.
+static size_t
+index_find(const struct threadexec_graph *graph, word_t remote_address) {
+	for (size_t slot = index_slot(graph, remote_address);; slot = (slot + 1) & graph->index_mask) {
+		size_t entry = graph->index[slot];
+		if (entry == 0) {
+			return -1;
+		}
+		if (graph->remote[entry - 1] == remote_address) {
+			return entry - 1;
+		}
+	}
+}
+
+static void
+index_insert(struct threadexec_graph *graph, word_t remote_address, size_t node) {
+	size_t slot = index_slot(graph, remote_address);
+	while (graph->index[slot] != 0) {
+		slot = (slot + 1) & graph->index_mask;
+	}
+	graph->index[slot] = node + 1;
+}
+
+static bool
+unreadable_contains(const struct threadexec_graph *graph, word_t remote_address) {
+	for (size_t slot = index_slot(graph, remote_address);; slot = (slot + 1) & graph->index_mask) {
+		word_t entry = graph->unreadable[slot];
+		if (entry == 0) {
+			return false;
+		}
+		if (entry == remote_address) {
+			return true;
+		}
+	}
+}
+
+static void
+unreadable_insert(struct threadexec_graph *graph, word_t remote_address) {
+	if (graph->unreadable_count == graph->max_nodes) {
+		return;
+	}
+	size_t slot = index_slot(graph, remote_address);
+	while (graph->unreadable[slot] != 0) {
+		if (graph->unreadable[slot] == remote_address) {
+			return;
+		}
+		slot = (slot + 1) & graph->index_mask;
+	}
+	graph->unreadable[slot] = remote_address;
+	graph->unreadable_count++;
+}
+
+// Read the nodes in [start, end) with a single scatter-gather read. Nodes that can't be read are
+// removed by compacting the remaining nodes down and recorded as unreadable. Returns the new end.
+static size_t
+fetch_level(threadexec_t threadexec, struct threadexec_graph *graph, size_t start, size_t end) {
+	size_t count = end - start;
+	struct threadexec_iovec *iov = malloc(count * sizeof(*iov));
+	assert(iov != NULL);
+	for (size_t i = 0; i < count; i++) {
+		iov[i].remote_address = (const void *) graph->remote[start + i];
+		iov[i].data           = graph->arena + (start + i) * graph->node_size;
+		iov[i].size           = graph->node_size;
+	}
+	threadexec_readv(threadexec, iov, count);
+	size_t kept = start;
+	for (size_t i = 0; i < count; i++) {
+		if (iov[i].transferred != iov[i].size) {
+			DEBUG_TRACE(2, "Could not read graph node at %p", iov[i].remote_address);
+			unreadable_insert(graph, (word_t) iov[i].remote_address);
+			continue;
+		}
+		if (kept != start + i) {
+			graph->remote[kept] = graph->remote[start + i];
+			memcpy(graph->arena + kept * graph->node_size, iov[i].data,
+					graph->node_size);
+		}
+		kept++;
+	}
+	free(iov);
+	return kept;
+}
+
+bool
+threadexec_graph_fetch(threadexec_t threadexec, const void *root,
+		const struct threadexec_graph_schema *schema, threadexec_graph_t *graph_out) {
+	assert(schema->node_size > 0 && schema->max_nodes > 0);
+	for (size_t i = 0; i < schema->pointer_count; i++) {
+		assert(schema->pointer_offsets[i] + sizeof(word_t) <= schema->node_size);
+	}
+	struct threadexec_graph *graph = calloc(1, sizeof(*graph));
+	assert(graph != NULL);
+	size_t slots = 2;
+	while (slots < 2 * schema->max_nodes) {
+		slots <<= 1;
+	}
+	graph->node_size  = schema->node_size;
+	graph->index_mask = slots - 1;
+	graph->max_nodes  = schema->max_nodes;
+	graph->index      = calloc(slots, sizeof(*graph->index));
+	graph->unreadable = calloc(slots, sizeof(*graph->unreadable));
+	graph->remote     = malloc(schema->max_nodes * sizeof(*graph->remote));
+	graph->arena      = malloc(schema->max_nodes * schema->node_size);
+	assert(graph->index != NULL && graph->unreadable != NULL && graph->remote != NULL
+			&& graph->arena != NULL);
+	// Start with the root.
+	graph->remote[0] = (word_t) root;
+	size_t level_start = 0;
+	size_t level_end   = fetch_level(threadexec, graph, 0, 1);
+	if (level_end == 0) {
+		ERROR("Could not read graph root %p", root);
+		threadexec_graph_free(graph);
+		return false;
+	}
+	index_insert(graph, (word_t) root, 0);
+	// Walk the graph one level at a time. The pointers in the nodes of one level define the
+	// nodes of the next level, which are all fetched together.
+	for (unsigned depth = 0; depth < schema->max_depth; depth++) {
+		size_t next_end = level_end;
+		for (size_t node = level_start; node < level_end; node++) {
+			const uint8_t *local = graph->arena + node * graph->node_size;
+			for (size_t i = 0; i < schema->pointer_count; i++) {
+				if (next_end == schema->max_nodes) {
+					break;
+				}
+				word_t pointer;
+				memcpy(&pointer, local + schema->pointer_offsets[i], sizeof(pointer));
+				if (pointer == 0 || index_find(graph, pointer) != -1
+						|| unreadable_contains(graph, pointer)) {
+					continue;
+				}
+				graph->remote[next_end] = pointer;
+				index_insert(graph, pointer, next_end);
+				next_end++;
+			}
+		}
+		if (next_end == level_end) {
+			break;
+		}
+		// Fetch the whole level. Nodes that couldn't be read are dropped and remembered as
+		// unreadable so that later levels don't queue them again. Dropping them moves the
+		// survivors, so rebuild their index entries.
+		size_t fetched_end = fetch_level(threadexec, graph, level_end, next_end);
+		if (fetched_end != next_end) {
+			memset(graph->index, 0, (graph->index_mask + 1) * sizeof(*graph->index));
+			for (size_t node = 0; node < fetched_end; node++) {
+				index_insert(graph, graph->remote[node], node);
+			}
+		}
+		level_start = level_end;
+		level_end   = fetched_end;
+	}
+	graph->node_count = level_end;
+	*graph_out = graph;
+	return true;
+}
+
+size_t
+threadexec_graph_node_count(threadexec_graph_t graph) {
+	return graph->node_count;
+}
+
+const void *
+threadexec_graph_node(threadexec_graph_t graph, size_t index, const void **remote_address) {
+	assert(index < graph->node_count);
+	if (remote_address != NULL) {
+		*remote_address = (const void *) graph->remote[index];
+	}
+	return graph->arena + index * graph->node_size;
+}
+
+const void *
+threadexec_graph_lookup(threadexec_graph_t graph, const void *remote_address) {
+	size_t node = index_find(graph, (word_t) remote_address);
+	if (node == -1 || node >= graph->node_count) {
+		return NULL;
+	}
+	return graph->arena + node * graph->node_size;
+}
+
+void
+threadexec_graph_free(threadexec_graph_t graph) {
+	free(graph->arena);
+	free(graph->remote);
+	free(graph->index);
+	free(graph->unreadable);
+	free(graph);
+}
@@ -3,8 +3,15 @@
 #include "task_api/tx_init_task.h"
 #include "thread_api/tx_init_thread.h"
 #include "tx_call.h"
+#include "tx_init_shmem.h"
 #include "tx_log.h"
+#include "tx_params.h"
 #include "tx_prototypes.h"
+#include "tx_read_cache.h"
+#include "tx_shared_vm_pool.h"
+#include "tx_stack_profile.h"
+#include "tx_vm_map.h"
+#include "tx_write_buffer.h"
 #include "tx_utils.h"
 
 #include <assert.h>
@@ -15,7 +22,7 @@
 
 #define SUPPORTED_FLAGS	\
 	(TX_SUSPEND_THREADS | KILL_FLAGS | TX_SUSPEND | TX_RESUME | TX_BORROW_PORTS \
-	 | TX_BARE_THREAD)
+	 | TX_BARE_THREAD | TX_SAFE_MEMORY_ACCESS)
 
 // Suspend all the threads in a task, except for the specified one.
 static bool
@@ -89,17 +96,16 @@ tx_init_internal(threadexec_t threadexec) {
 	}
 	// Try initializing with the task APIs. This function performs its own cleanup on failure.
 	ok = tx_init_with_task_api(threadexec);
-	if (ok) {
-		return true;
-	}
 	// If that doesn't work and this platform supports the thread APIs, try that. This function
 	// performs its own cleanup on failure.
 #if TX_HAVE_THREAD_API
-	ok = tx_init_with_thread_api(threadexec);
+	if (!ok) {
+		ok = tx_init_with_thread_api(threadexec);
+	}
+#endif
 	if (ok) {
 		return true;
 	}
-#endif
 	// If we preserved the thread state, restore it.
 	if (threadexec->flags & TX_PRESERVE) {
 		tx_preserve_restore(threadexec);
@@ -113,8 +119,44 @@ fail_0:
 	return false;
 }
 
+// Fill in the default shared memory geometry and validate it.
+static void
+resolve_init_options(struct threadexec_init_options *resolved,
+		const struct threadexec_init_options *options) {
+	if (options != NULL) {
+		*resolved = *options;
+	}
+	if (resolved->stack_size == 0) {
+		resolved->stack_size = TX_STACK_SIZE;
+	}
+	if (resolved->client_shmem_size == 0) {
+		resolved->client_shmem_size = TX_CLIENT_SHMEM_SIZE;
+	}
+	if (resolved->staging_buffer_size == 0) {
+		resolved->staging_buffer_size = TX_STAGING_BUFFER_SIZE;
+	}
+	if (resolved->staging_buffer_count == 0) {
+		resolved->staging_buffer_count = TX_STAGING_BUFFER_COUNT;
+	}
+	if (resolved->alignment == 0) {
+		resolved->alignment = TX_SHMEM_ALIGNMENT;
+	}
+	assert(resolved->staging_buffer_count >= 2);
+	assert(lobit(resolved->alignment) == resolved->alignment);
+	assert(resolved->alignment % vm_page_size == 0);
+	// The Mach messages used for transfers are built at the bottom of the shared memory region,
+	// so the staging buffers must be able to hold them.
+	assert(resolved->staging_buffer_size >= 0x1000);
+}
+
 threadexec_t
 threadexec_init(task_t task, thread_t thread, tx_create_flags_t flags) {
+	return threadexec_init_with_options(task, thread, flags, NULL);
+}
+
+threadexec_t
+threadexec_init_with_options(task_t task, thread_t thread, tx_create_flags_t flags,
+		const struct threadexec_init_options *options) {
 	// Validate the flags.
 	assert((flags & SUPPORTED_FLAGS) == flags);
 	// We can't both kill and resume.
@@ -138,12 +180,18 @@ threadexec_init(task_t task, thread_t thread, tx_create_flags_t flags) {
 	threadexec->task   = task;
 	threadexec->thread = thread;
 	threadexec->flags  = flags;
+	resolve_init_options(&threadexec->shmem_options, options);
 	// Now initialize.
 	bool ok = tx_init_internal(threadexec);
 	if (!ok) {
 		free(threadexec);
 		return NULL;
 	}
+	// Set up the shared memory region once it is final. This is done here rather than in
+	// tx_init_internal, which runs twice when hijacking a thread. The guard page is a safety
+	// net rather than a requirement, so carry on without it.
+	tx_init_shmem_protect_guard(threadexec);
+	tx_init_shmem_prefault(threadexec);
 	return threadexec;
 }
 
@@ -178,6 +226,15 @@ kill_threads(task_t task) {
 void
 threadexec_deinit(threadexec_t threadexec) {
 	assert(threadexec != NULL);
+	// Release any resources that need remote calls to clean up. Pending writes are flushed
+	// first, since the flush uses the scatter-gather pipe.
+	tx_write_buffer_deinit(threadexec);
+	tx_read_cache_deinit(threadexec);
+	tx_vector_io_deinit(threadexec);
+	tx_shared_vm_pool_deinit(threadexec);
+	tx_vm_map_deinit(threadexec);
+	tx_shared_vm_deinit(threadexec);
+	tx_stack_profile_deinit(threadexec);
 #if TX_HAVE_THREAD_API
 	bool done = false;
 	if (tx_supports_task_api(threadexec)) {
@@ -0,0 +1,173 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_utils.h"
+#include "tx_write_buffer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+struct threadexec_mirror {
+	word_t remote_address;
+	size_t size;
+	size_t block_size;
+	// The local copy of the remote range.
+	uint8_t *data;
+	// The changed ranges found by the last sync.
+	struct threadexec_mirror_change *changes;
+	size_t change_count;
+	size_t change_capacity;
+};
+
+// Compare two blocks. The loop uses independent accumulators over 64-bit words so that the
+// compiler can turn it into vector compares; the result is only inspected once per block.
+static bool
+block_differs(const uint8_t *a, const uint8_t *b, size_t size) {
+	const size_t lanes = 4;
+	const size_t stride = lanes * sizeof(uint64_t);
+	uint64_t diff[4] = {};
+	size_t offset = 0;
+	for (; offset + stride <= size; offset += stride) {
+		uint64_t wa[4], wb[4];
+		memcpy(wa, a + offset, stride);
+		memcpy(wb, b + offset, stride);
+		for (size_t i = 0; i < lanes; i++) {
+			diff[i] |= wa[i] ^ wb[i];
+		}
+	}
+	if ((diff[0] | diff[1] | diff[2] | diff[3]) != 0) {
+		return true;
+	}
+	return memcmp(a + offset, b + offset, size - offset) != 0;
+}
+
+// Record that the block at the given offset changed, extending the previous change if it is
+// adjacent.
+static void
+add_change(threadexec_mirror_t mirror, size_t offset, size_t size) {
+	if (mirror->change_count > 0) {
+		struct threadexec_mirror_change *last = &mirror->changes[mirror->change_count - 1];
+		if (last->offset + last->size == offset) {
+			last->size += size;
+			return;
+		}
+	}
+	if (mirror->change_count == mirror->change_capacity) {
+		mirror->change_capacity = max(2 * mirror->change_capacity, (size_t) 16);
+		mirror->changes = realloc(mirror->changes,
+				mirror->change_capacity * sizeof(*mirror->changes));
+		assert(mirror->changes != NULL);
+	}
+	mirror->changes[mirror->change_count].offset = offset;
+	mirror->changes[mirror->change_count].size   = size;
+	mirror->change_count++;
+}
+
+// Compare the current contents of the remote range against the mirror, updating the mirror and
+// the list of changes.
+static void
+diff_and_update(threadexec_mirror_t mirror, const uint8_t *current) {
+	mirror->change_count = 0;
+	for (size_t offset = 0; offset < mirror->size; offset += mirror->block_size) {
+		size_t size = min(mirror->block_size, mirror->size - offset);
+		if (block_differs(mirror->data + offset, current + offset, size)) {
+			memcpy(mirror->data + offset, current + offset, size);
+			add_change(mirror, offset, size);
+		}
+	}
+}
+
+// Fetch the current contents of the remote range and diff them against the mirror. We take a
+// copy-on-write snapshot so that no data is copied for unchanged blocks. If that fails we read
+// the whole range into a scratch buffer instead.
+static bool
+sync_mirror(threadexec_t threadexec, threadexec_mirror_t mirror) {
+	struct threadexec_snapshot_range range = {
+		.remote_address = (const void *) mirror->remote_address,
+		.size           = mirror->size,
+	};
+	bool ok = threadexec_snapshot_region(threadexec, &range, 1, false);
+	if (ok) {
+		diff_and_update(mirror, range.local_address);
+		threadexec_snapshot_release(&range, 1);
+		return true;
+	}
+	DEBUG_TRACE(1, "Could not snapshot mirrored range; reading it instead");
+	uint8_t *current = malloc(mirror->size);
+	assert(current != NULL);
+	// Read around the read cache, which may hold stale data.
+	ok = tx_write_buffer_flush_range(threadexec, mirror->remote_address, mirror->size);
+	if (ok) {
+		ok = tx_read_direct(threadexec, mirror->remote_address, current, mirror->size);
+	}
+	if (ok) {
+		diff_and_update(mirror, current);
+	}
+	free(current);
+	return ok;
+}
+
+bool
+threadexec_mirror_create(threadexec_t threadexec, const void *remote_address, size_t size,
+		size_t block_size, threadexec_mirror_t *mirror) {
+	if (block_size == 0) {
+		block_size = TX_MIRROR_BLOCK_SIZE;
+	}
+	threadexec_mirror_t m = calloc(1, sizeof(*m));
+	if (m == NULL) {
+		goto fail_0;
+	}
+	m->remote_address = (word_t) remote_address;
+	m->size           = size;
+	m->block_size     = block_size;
+	m->data           = calloc(1, size);
+	if (m->data == NULL) {
+		goto fail_1;
+	}
+	// The first sync fills the mirror. Its change list is not meaningful.
+	bool ok = sync_mirror(threadexec, m);
+	if (!ok) {
+		ERROR("Could not read mirrored range %p-%p", remote_address,
+				(const uint8_t *) remote_address + size);
+		goto fail_2;
+	}
+	m->change_count = 0;
+	*mirror = m;
+	return true;
+fail_2:
+	free(m->data);
+fail_1:
+	free(m->changes);
+	free(m);
+fail_0:
+	return false;
+}
+
+const void *
+threadexec_mirror_data(threadexec_mirror_t mirror) {
+	return mirror->data;
+}
+
+bool
+threadexec_mirror_sync(threadexec_t threadexec, threadexec_mirror_t mirror,
+		const struct threadexec_mirror_change **changes, size_t *change_count) {
+	bool ok = sync_mirror(threadexec, mirror);
+	if (!ok) {
+		mirror->change_count = 0;
+	}
+	if (changes != NULL) {
+		*changes = mirror->changes;
+	}
+	if (change_count != NULL) {
+		*change_count = mirror->change_count;
+	}
+	return ok;
+}
+
+void
+threadexec_mirror_free(threadexec_mirror_t mirror) {
+	free(mirror->changes);
+	free(mirror->data);
+	free(mirror);
+}
@@ -0,0 +1,373 @@
+#include "tx_read_cache.h"
+
+#include "tx_internal.h"
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_utils.h"
+#include "tx_vm_map.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define PAGE_SIZE_CACHE TX_READ_CACHE_PAGE_SIZE
+
+// A cached page of remote memory. Every page is always on the LRU list, with the most recently
+// used at the head. Pages that are not valid are kept at the tail so that they are reused first.
+struct tx_read_cache_page {
+	word_t address;
+	uint64_t epoch;
+	struct tx_read_cache_page *hash_next;
+	struct tx_read_cache_page *lru_prev;
+	struct tx_read_cache_page *lru_next;
+	bool valid;
+	bool prefetched;
+	uint8_t *data;
+};
+
+struct tx_read_cache {
+	size_t page_count;
+	size_t readahead_pages;
+	uint64_t epoch;
+	// Sequential access detection: the page just after the end of the previous read and the
+	// number of consecutive reads that have started there.
+	word_t next_page;
+	unsigned sequential;
+	// The hash table, LRU list, and backing storage.
+	size_t hash_mask;
+	struct tx_read_cache_page **hash;
+	struct tx_read_cache_page *lru_head;
+	struct tx_read_cache_page *lru_tail;
+	struct tx_read_cache_page *pages;
+	uint8_t *storage;
+	struct threadexec_read_cache_stats stats;
+};
+
+static size_t
+hash_index(struct tx_read_cache *cache, word_t address) {
+	uint64_t page = address / PAGE_SIZE_CACHE;
+	return (size_t) ((page * 0x9e3779b97f4a7c15) >> 32) & cache->hash_mask;
+}
+
+static void
+lru_unlink(struct tx_read_cache *cache, struct tx_read_cache_page *page) {
+	if (page->lru_prev != NULL) {
+		page->lru_prev->lru_next = page->lru_next;
+	} else {
+		cache->lru_head = page->lru_next;
+	}
+	if (page->lru_next != NULL) {
+		page->lru_next->lru_prev = page->lru_prev;
+	} else {
+		cache->lru_tail = page->lru_prev;
+	}
+	page->lru_prev = NULL;
+	page->lru_next = NULL;
+}
+
+static void
+lru_push_head(struct tx_read_cache *cache, struct tx_read_cache_page *page) {
+	page->lru_next = cache->lru_head;
+	if (cache->lru_head != NULL) {
+		cache->lru_head->lru_prev = page;
+	} else {
+		cache->lru_tail = page;
+	}
+	cache->lru_head = page;
+}
+
+static void
+lru_push_tail(struct tx_read_cache *cache, struct tx_read_cache_page *page) {
+	page->lru_prev = cache->lru_tail;
+	if (cache->lru_tail != NULL) {
+		cache->lru_tail->lru_next = page;
+	} else {
+		cache->lru_head = page;
+	}
+	cache->lru_tail = page;
+}
+
+// Find the page for an address. The page may be stale.
+static struct tx_read_cache_page *
+lookup(struct tx_read_cache *cache, word_t address) {
+	struct tx_read_cache_page *page = cache->hash[hash_index(cache, address)];
+	while (page != NULL && page->address != address) {
+		page = page->hash_next;
+	}
+	return page;
+}
+
+// Find a page that holds current data for the address.
+static struct tx_read_cache_page *
+lookup_current(struct tx_read_cache *cache, word_t address) {
+	struct tx_read_cache_page *page = lookup(cache, address);
+	if (page != NULL && page->epoch != cache->epoch) {
+		return NULL;
+	}
+	return page;
+}
+
+// Remove a page from the hash table and move it to the tail of the LRU list.
+static void
+invalidate_page(struct tx_read_cache *cache, struct tx_read_cache_page *page) {
+	struct tx_read_cache_page **link = &cache->hash[hash_index(cache, page->address)];
+	while (*link != page) {
+		link = &(*link)->hash_next;
+	}
+	*link = page->hash_next;
+	page->hash_next = NULL;
+	page->valid = false;
+	lru_unlink(cache, page);
+	lru_push_tail(cache, page);
+}
+
+// Get a page to hold the data for the given address, evicting the least recently used page if
+// necessary. The returned page is at the head of the LRU list and hashed, but not yet valid.
+static struct tx_read_cache_page *
+allocate_page(struct tx_read_cache *cache, word_t address) {
+	struct tx_read_cache_page *page = lookup(cache, address);
+	if (page == NULL) {
+		page = cache->lru_tail;
+		if (page->valid) {
+			if (page->epoch == cache->epoch) {
+				cache->stats.evictions++;
+			}
+			invalidate_page(cache, page);
+		}
+		page->address = address;
+		size_t index = hash_index(cache, address);
+		page->hash_next = cache->hash[index];
+		cache->hash[index] = page;
+	}
+	page->valid = true;
+	page->epoch = cache->epoch - 1;
+	page->prefetched = false;
+	lru_unlink(cache, page);
+	lru_push_head(cache, page);
+	return page;
+}
+
+// Fetch the pages with a single scatter-gather read. Demanded pages must be read in full;
+// read-ahead pages that fail are quietly dropped.
+static bool
+fill_pages(threadexec_t threadexec, struct tx_read_cache_page **pages, size_t count,
+		size_t demand_count) {
+	struct tx_read_cache *cache = threadexec->read_cache;
+	struct threadexec_iovec *iov = malloc(count * sizeof(*iov));
+	assert(iov != NULL);
+	for (size_t i = 0; i < count; i++) {
+		iov[i].remote_address = (const void *) pages[i]->address;
+		iov[i].data           = pages[i]->data;
+		iov[i].size           = PAGE_SIZE_CACHE;
+	}
+	threadexec_readv(threadexec, iov, count);
+	bool success = true;
+	for (size_t i = 0; i < count; i++) {
+		if (iov[i].transferred == PAGE_SIZE_CACHE) {
+			pages[i]->epoch = cache->epoch;
+			pages[i]->prefetched = (i >= demand_count);
+		} else {
+			invalidate_page(cache, pages[i]);
+			if (i < demand_count) {
+				success = false;
+			}
+		}
+	}
+	free(iov);
+	return success;
+}
+
+bool
+tx_read_cache_read(threadexec_t threadexec, word_t remote_address, void *data, size_t size) {
+	struct tx_read_cache *cache = threadexec->read_cache;
+	assert(cache != NULL);
+	if (size == 0) {
+		return true;
+	}
+	word_t first = round2_down(remote_address, PAGE_SIZE_CACHE);
+	word_t last  = round2_down(remote_address + size - 1, PAGE_SIZE_CACHE);
+	size_t page_count = (last - first) / PAGE_SIZE_CACHE + 1;
+	// Reads that would churn a large part of the cache go directly to the remote thread.
+	if (page_count > cache->page_count / 2) {
+		cache->stats.bypasses++;
+		cache->next_page = last + PAGE_SIZE_CACHE;
+		return tx_read_direct(threadexec, remote_address, data, size);
+	}
+	// Track sequential access.
+	if (first == cache->next_page || first + PAGE_SIZE_CACHE == cache->next_page) {
+		cache->sequential++;
+	} else {
+		cache->sequential = 0;
+	}
+	cache->next_page = last + PAGE_SIZE_CACHE;
+	// Copy out the pages we have and collect the ones we need.
+	size_t readahead = (cache->sequential > 0 ? cache->readahead_pages : 0);
+	struct tx_read_cache_page **fill = malloc((page_count + readahead) * sizeof(*fill));
+	assert(fill != NULL);
+	size_t fill_count = 0;
+	for (word_t address = first; address <= last; address += PAGE_SIZE_CACHE) {
+		struct tx_read_cache_page *page = lookup_current(cache, address);
+		if (page == NULL) {
+			cache->stats.misses++;
+			fill[fill_count++] = allocate_page(cache, address);
+			continue;
+		}
+		cache->stats.hits++;
+		if (page->prefetched) {
+			cache->stats.readahead_hits++;
+			page->prefetched = false;
+		}
+		lru_unlink(cache, page);
+		lru_push_head(cache, page);
+		word_t start = (address < remote_address ? remote_address : address);
+		word_t end   = min(address + PAGE_SIZE_CACHE, remote_address + size);
+		memcpy((uint8_t *) data + (start - remote_address),
+				page->data + (start - address), end - start);
+	}
+	bool success = true;
+	if (fill_count == 0) {
+		goto done;
+	}
+	// Add read-ahead pages after the end of the read. Since we only read ahead when we
+	// already have to go to the remote thread, read-ahead never costs an extra round trip.
+	size_t demand_count = fill_count;
+	for (size_t i = 1; i <= readahead; i++) {
+		word_t address = last + i * PAGE_SIZE_CACHE;
+		// Don't read ahead past the end of what we know to be mapped.
+		if (!tx_vm_map_check(threadexec, address, PAGE_SIZE_CACHE, VM_PROT_READ, false)) {
+			break;
+		}
+		if (lookup_current(cache, address) != NULL) {
+			continue;
+		}
+		fill[fill_count++] = allocate_page(cache, address);
+		cache->stats.readahead++;
+	}
+	success = fill_pages(threadexec, fill, fill_count, demand_count);
+	if (!success) {
+		ERROR("Could not read remote address %p", (void *) remote_address);
+		goto done;
+	}
+	// Copy out the pages we just filled.
+	for (size_t i = 0; i < demand_count; i++) {
+		word_t address = fill[i]->address;
+		word_t start = (address < remote_address ? remote_address : address);
+		word_t end   = min(address + PAGE_SIZE_CACHE, remote_address + size);
+		memcpy((uint8_t *) data + (start - remote_address),
+				fill[i]->data + (start - address), end - start);
+	}
+done:
+	free(fill);
+	return success;
+}
+
+void
+tx_read_cache_update(threadexec_t threadexec,
+		word_t remote_address, const void *data, size_t size) {
+	struct tx_read_cache *cache = threadexec->read_cache;
+	if (cache == NULL || size == 0) {
+		return;
+	}
+	word_t first = round2_down(remote_address, PAGE_SIZE_CACHE);
+	word_t last  = round2_down(remote_address + size - 1, PAGE_SIZE_CACHE);
+	for (word_t address = first; address <= last; address += PAGE_SIZE_CACHE) {
+		struct tx_read_cache_page *page = lookup(cache, address);
+		if (page == NULL) {
+			continue;
+		}
+		if (data == NULL || page->epoch != cache->epoch) {
+			invalidate_page(cache, page);
+			continue;
+		}
+		word_t start = (address < remote_address ? remote_address : address);
+		word_t end   = min(address + PAGE_SIZE_CACHE, remote_address + size);
+		memcpy(page->data + (start - address),
+				(const uint8_t *) data + (start - remote_address), end - start);
+	}
+}
+
+void
+tx_read_cache_deinit(threadexec_t threadexec) {
+	struct tx_read_cache *cache = threadexec->read_cache;
+	if (cache == NULL) {
+		return;
+	}
+	free(cache->storage);
+	free(cache->pages);
+	free(cache->hash);
+	free(cache);
+	threadexec->read_cache = NULL;
+}
+
+bool
+threadexec_read_cache_enable(threadexec_t threadexec, size_t cache_size, size_t readahead_size) {
+	tx_read_cache_deinit(threadexec);
+	size_t page_count = cache_size / PAGE_SIZE_CACHE;
+	if (page_count < 2) {
+		ERROR("Read cache size %zu is too small", cache_size);
+		return false;
+	}
+	struct tx_read_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		goto fail_0;
+	}
+	cache->page_count      = page_count;
+	cache->readahead_pages = min(readahead_size / PAGE_SIZE_CACHE, page_count / 2);
+	cache->epoch           = 1;
+	size_t bucket_count = 1;
+	while (bucket_count < page_count) {
+		bucket_count <<= 1;
+	}
+	cache->hash_mask = bucket_count - 1;
+	cache->hash      = calloc(bucket_count, sizeof(*cache->hash));
+	cache->pages     = calloc(page_count, sizeof(*cache->pages));
+	cache->storage   = malloc(page_count * PAGE_SIZE_CACHE);
+	if (cache->hash == NULL || cache->pages == NULL || cache->storage == NULL) {
+		goto fail_1;
+	}
+	for (size_t i = 0; i < page_count; i++) {
+		cache->pages[i].data = cache->storage + i * PAGE_SIZE_CACHE;
+		lru_push_tail(cache, &cache->pages[i]);
+	}
+	threadexec->read_cache = cache;
+	return true;
+fail_1:
+	free(cache->storage);
+	free(cache->pages);
+	free(cache->hash);
+	free(cache);
+fail_0:
+	ERROR("Could not allocate read cache");
+	return false;
+}
+
+void
+threadexec_read_cache_disable(threadexec_t threadexec) {
+	tx_read_cache_deinit(threadexec);
+}
+
+void
+threadexec_read_cache_invalidate(threadexec_t threadexec,
+		const void *remote_address, size_t size) {
+	tx_read_cache_update(threadexec, (word_t) remote_address, NULL, size);
+}
+
+uint64_t
+threadexec_read_cache_new_epoch(threadexec_t threadexec) {
+	struct tx_read_cache *cache = threadexec->read_cache;
+	if (cache == NULL) {
+		return 0;
+	}
+	cache->sequential = 0;
+	return ++cache->epoch;
+}
+
+void
+threadexec_read_cache_get_stats(threadexec_t threadexec,
+		struct threadexec_read_cache_stats *stats) {
+	struct tx_read_cache *cache = threadexec->read_cache;
+	if (cache == NULL) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	*stats = cache->stats;
+}
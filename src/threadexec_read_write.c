@@ -1,48 +1,491 @@
 #include "tx_internal.h"
 
+#include "tx_call.h"
 #include "tx_log.h"
+#include "tx_ool_transfer.h"
+#include "tx_params.h"
+#include "tx_read_cache.h"
 #include "tx_utils.h"
+#include "tx_vm_map.h"
+#include "tx_write_buffer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 // If we had a usable task port we'd use that, but sadly we just have memcpy.
 
-// Transfer data from the local buffer to the remote address or vice versa. Currently data is
-// transferred in 16K chunks, with no special treatment for especially large buffers.
+// Get the local address of the staging buffer used for the given chunk.
+static uint8_t *
+staging_local(threadexec_t threadexec, size_t chunk) {
+	size_t index = chunk % threadexec->staging_buffer_count;
+	return (uint8_t *) threadexec->staging + index * threadexec->staging_buffer_size;
+}
+
+// Get the remote address of the staging buffer used for the given chunk.
+static word_t
+staging_remote(threadexec_t threadexec, size_t chunk) {
+	size_t index = chunk % threadexec->staging_buffer_count;
+	return threadexec->staging_remote + index * threadexec->staging_buffer_size;
+}
+
+// Start the remote memcpy for a single chunk without waiting for it to finish.
+static bool
+start_chunk_transfer(threadexec_t threadexec, size_t chunk, word_t remote_address,
+		size_t chunk_size, bool is_write) {
+	word_t buffer_remote = staging_remote(threadexec, chunk);
+	struct threadexec_call_argument memcpy_args[3] = {
+		TX_ARG(void *,       (is_write ? remote_address : buffer_remote)),
+		TX_ARG(const void *, (is_write ? buffer_remote  : remote_address)),
+		TX_ARG(size_t,       chunk_size),
+	};
+	return tx_call_async(threadexec, (word_t) memcpy, 3, memcpy_args);
+}
+
+// Transfer data from the local buffer to the remote address or vice versa. Data is transferred in
+// chunks the size of a staging buffer. The transfer is pipelined across the staging buffers: for
+// reads, the remote thread copies chunk N+1 while we copy chunk N out locally; for writes, we copy
+// chunk N+1 in locally while the remote thread copies out chunk N.
 static bool
 transfer(threadexec_t threadexec, word_t remote_address, void *data, size_t size, bool is_write) {
-	void *shmem_local = threadexec->shmem;
-	word_t shmem_remote = threadexec->shmem_remote;
-	while (size > 0) {
-		size_t transfer_size = min(size, 0x4000);
-		if (is_write) {
-			memcpy(shmem_local, data, transfer_size);
-		}
-		struct threadexec_call_argument memcpy_args[3] = {
-			TX_ARG(void *,       (is_write ? remote_address : shmem_remote)),
-			TX_ARG(const void *, (is_write ? shmem_remote   : remote_address)),
-			TX_ARG(size_t,       transfer_size),
-		};
-		bool ok = threadexec_call(threadexec, NULL, 0, memcpy, 3, memcpy_args);
+	const size_t buffer_size = threadexec->staging_buffer_size;
+	const size_t chunk_count = (size + buffer_size - 1) / buffer_size;
+	uint8_t *local = data;
+	size_t done = 0;
+	bool ok = true;
+	if (is_write) {
+		// Prime the first staging buffer.
+		if (chunk_count > 0) {
+			memcpy(staging_local(threadexec, 0), local, min(size, buffer_size));
+		}
+		for (size_t i = 0; i < chunk_count; i++) {
+			size_t offset     = i * buffer_size;
+			size_t chunk_size = min(size - offset, buffer_size);
+			ok = start_chunk_transfer(threadexec, i, remote_address + offset,
+					chunk_size, true);
+			if (!ok) {
+				break;
+			}
+			// While the remote thread copies this chunk, stage the next one.
+			size_t next_offset = offset + chunk_size;
+			if (next_offset < size) {
+				memcpy(staging_local(threadexec, i + 1), local + next_offset,
+						min(size - next_offset, buffer_size));
+			}
+			ok = tx_call_wait(threadexec, NULL, 0);
+			if (!ok) {
+				break;
+			}
+			done += chunk_size;
+		}
+	} else {
+		// Start fetching the first chunk.
+		if (chunk_count > 0) {
+			ok = start_chunk_transfer(threadexec, 0, remote_address,
+					min(size, buffer_size), false);
+		}
+		for (size_t i = 0; ok && i < chunk_count; i++) {
+			size_t offset     = i * buffer_size;
+			size_t chunk_size = min(size - offset, buffer_size);
+			ok = tx_call_wait(threadexec, NULL, 0);
+			if (!ok) {
+				break;
+			}
+			// Start fetching the next chunk before copying this one out.
+			size_t next_offset = offset + chunk_size;
+			if (next_offset < size) {
+				ok = start_chunk_transfer(threadexec, i + 1,
+						remote_address + next_offset,
+						min(size - next_offset, buffer_size), false);
+			}
+			memcpy(local + offset, staging_local(threadexec, i), chunk_size);
+			done += chunk_size;
+		}
+	}
+	if (done != size) {
+		ERROR("Memory transfer failed with %zu bytes left", size - done);
+	}
+	return (done == size);
+}
+
+// Transfer data, using out-of-line Mach messages for large sizes. Below the threshold the cost of
+// mapping and unmapping the virtual copy outweighs the savings over the staging buffers. If the
+// message transfer fails for any reason we fall back to the staging buffers.
+static bool
+bulk_transfer(threadexec_t threadexec, word_t remote_address, void *data, size_t size,
+		bool is_write) {
+	// A bad address would crash the remote thread, so if we know the address space, reject
+	// the transfer up front.
+	bool ok = tx_vm_map_check(threadexec, remote_address, size,
+			(is_write ? VM_PROT_WRITE : VM_PROT_READ), true);
+	if (!ok) {
+		ERROR("Remote range %p-%p is not mapped %s", (void *) remote_address,
+				(void *) (remote_address + size), (is_write ? "writable" : "readable"));
+		return false;
+	}
+	if (threadexec->flags & TX_SAFE_MEMORY_ACCESS) {
+		size_t done;
+		ok = tx_safe_transfer(threadexec, remote_address, data, size, is_write, &done);
 		if (!ok) {
-			ERROR("Memory transfer failed with %zu bytes left", size);
-			break;
+			ERROR("Memory transfer failed with %zu bytes left", size - done);
+		}
+		return ok;
+	}
+	if (size >= TX_OOL_TRANSFER_THRESHOLD) {
+		if (is_write) {
+			ok = tx_ool_write(threadexec, remote_address, data, size);
+		} else {
+			ok = tx_ool_read(threadexec, remote_address, data, size);
 		}
-		if (!is_write) {
-			memcpy(data, shmem_local, transfer_size);
+		if (ok) {
+			return true;
 		}
-		size           -= transfer_size;
-		data            = (uint8_t *)data + transfer_size;
-		remote_address += transfer_size;
+		DEBUG_TRACE(1, "Out-of-line transfer failed; falling back to staging buffers");
 	}
-	return (size == 0);
+	return transfer(threadexec, remote_address, data, size, is_write);
+}
+
+bool
+tx_read_direct(threadexec_t threadexec, word_t remote_address, void *data, size_t size) {
+	return bulk_transfer(threadexec, remote_address, data, size, false);
 }
 
 bool
 threadexec_read(threadexec_t threadexec, const void *remote_address, void *data, size_t size) {
-	return transfer(threadexec, (word_t) remote_address, data, size, false);
+	// Pending writes to this range must land before we can read it back.
+	bool ok = tx_write_buffer_flush_range(threadexec, (word_t) remote_address, size);
+	if (!ok) {
+		return false;
+	}
+	if (threadexec->read_cache != NULL) {
+		return tx_read_cache_read(threadexec, (word_t) remote_address, data, size);
+	}
+	return bulk_transfer(threadexec, (word_t) remote_address, data, size, false);
 }
 
 bool
 threadexec_write(threadexec_t threadexec, const void *remote_address,
 		const void *data, size_t size) {
-	return transfer(threadexec, (word_t) remote_address, (void *) data, size, true);
+	if (tx_write_buffer_add(threadexec, (word_t) remote_address, data, size)) {
+		return true;
+	}
+	bool ok = bulk_transfer(threadexec, (word_t) remote_address, (void *) data, size, true);
+	// Keep the read cache coherent. If the write failed we don't know what made it.
+	tx_read_cache_update(threadexec, (word_t) remote_address, (ok ? data : NULL), size);
+	return ok;
+}
+
+// Stream a remote range through a bounded local buffer with the kernel doing the copies. This is
+// used in safe mode, where we can't use the remote memcpy.
+static bool
+read_stream_safe(threadexec_t threadexec, word_t remote_address, size_t size,
+		threadexec_read_stream_fn consumer, void *context) {
+	const size_t buffer_size = threadexec->staging_buffer_size;
+	uint8_t *buffer = malloc(buffer_size);
+	assert(buffer != NULL);
+	bool ok = true;
+	for (size_t offset = 0; ok && offset < size; offset += buffer_size) {
+		size_t chunk_size = min(size - offset, buffer_size);
+		ok = tx_safe_transfer(threadexec, remote_address + offset, buffer, chunk_size,
+				false, NULL);
+		if (!ok) {
+			ERROR("Could not read remote address %p", (void *) (remote_address + offset));
+			break;
+		}
+		ok = consumer(context, (const void *) (remote_address + offset), buffer,
+				chunk_size);
+	}
+	free(buffer);
+	return ok;
+}
+
+bool
+threadexec_read_stream(threadexec_t threadexec, const void *remote_address, size_t size,
+		bool pipelined, threadexec_read_stream_fn consumer, void *context) {
+	word_t address = (word_t) remote_address;
+	bool ok = tx_write_buffer_flush_range(threadexec, address, size);
+	if (!ok) {
+		return false;
+	}
+	ok = tx_vm_map_check(threadexec, address, size, VM_PROT_READ, true);
+	if (!ok) {
+		ERROR("Remote range %p-%p is not mapped readable", (void *) address,
+				(void *) (address + size));
+		return false;
+	}
+	if (threadexec->flags & TX_SAFE_MEMORY_ACCESS) {
+		return read_stream_safe(threadexec, address, size, consumer, context);
+	}
+	// Hand the consumer each chunk straight out of the staging buffer it was copied into, so
+	// the only local memory used is the shared memory region. When pipelined, the remote thread
+	// fills the next staging buffer while the consumer processes the current one.
+	const size_t buffer_size = threadexec->staging_buffer_size;
+	const size_t chunk_count = (size + buffer_size - 1) / buffer_size;
+	bool in_flight = false;
+	for (size_t i = 0; i < chunk_count; i++) {
+		size_t offset     = i * buffer_size;
+		size_t chunk_size = min(size - offset, buffer_size);
+		if (!in_flight) {
+			ok = start_chunk_transfer(threadexec, i, address + offset, chunk_size, false);
+			if (!ok) {
+				break;
+			}
+		}
+		ok = tx_call_wait(threadexec, NULL, 0);
+		in_flight = false;
+		if (!ok) {
+			break;
+		}
+		size_t next_offset = offset + chunk_size;
+		if (pipelined && next_offset < size) {
+			ok = start_chunk_transfer(threadexec, i + 1, address + next_offset,
+					min(size - next_offset, buffer_size), false);
+			if (!ok) {
+				break;
+			}
+			in_flight = true;
+		}
+		ok = consumer(context, (const void *) (address + offset),
+				staging_local(threadexec, i), chunk_size);
+		if (!ok) {
+			DEBUG_TRACE(2, "Read stream stopped by consumer at %p",
+					(void *) (address + offset));
+			break;
+		}
+	}
+	// Don't leave the remote thread running if the consumer stopped early.
+	if (in_flight) {
+		tx_call_wait(threadexec, NULL, 0);
+	}
+	return ok;
+}
+
+// Create the pipe used for scatter-gather transfers and insert both ends into the remote task.
+// Both ends are non-blocking so that neither side can stall on a full or empty pipe.
+static bool
+vector_pipe_init(threadexec_t threadexec) {
+	if (threadexec->vector_pipe_ready) {
+		return true;
+	}
+	int fds[2];
+	int err = pipe(fds);
+	if (err != 0) {
+		ERROR_CALL(pipe, "%d", errno);
+		goto fail_0;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+	}
+	int fd_r, fd_w;
+	bool ok = threadexec_file_insert(threadexec, fds[0], &fd_r);
+	if (!ok) {
+		goto fail_1;
+	}
+	ok = threadexec_file_insert(threadexec, fds[1], &fd_w);
+	if (!ok) {
+		threadexec_file_close(threadexec, fd_r);
+		goto fail_1;
+	}
+	threadexec->vector_pipe[0]        = fds[0];
+	threadexec->vector_pipe[1]        = fds[1];
+	threadexec->vector_pipe_remote[0] = fd_r;
+	threadexec->vector_pipe_remote[1] = fd_w;
+	threadexec->vector_pipe_ready     = true;
+	return true;
+fail_1:
+	close(fds[0]);
+	close(fds[1]);
+fail_0:
+	ERROR("Could not set up scatter-gather pipe");
+	return false;
+}
+
+void
+tx_vector_io_deinit(threadexec_t threadexec) {
+	if (!threadexec->vector_pipe_ready) {
+		return;
+	}
+	threadexec_file_close(threadexec, threadexec->vector_pipe_remote[0]);
+	threadexec_file_close(threadexec, threadexec->vector_pipe_remote[1]);
+	close(threadexec->vector_pipe[0]);
+	close(threadexec->vector_pipe[1]);
+	threadexec->vector_pipe_ready = false;
+}
+
+// Read everything currently in the pipe into the given local segments, or discard it if iov is
+// NULL. Returns the number of bytes drained.
+static size_t
+vector_pipe_drain(threadexec_t threadexec, struct iovec *iov, int iovcnt) {
+	size_t drained = 0;
+	for (;;) {
+		ssize_t n;
+		if (iov != NULL) {
+			n = readv(threadexec->vector_pipe[0], iov, iovcnt);
+		} else {
+			uint8_t discard[0x1000];
+			n = read(threadexec->vector_pipe[0], discard, sizeof(discard));
+		}
+		if (n <= 0) {
+			break;
+		}
+		drained += n;
+		// Advance the local segments past the data we just read.
+		for (size_t left = n; iov != NULL && left > 0 && iovcnt > 0;) {
+			size_t step = min(left, iov->iov_len);
+			iov->iov_base = (uint8_t *) iov->iov_base + step;
+			iov->iov_len -= step;
+			left         -= step;
+			if (iov->iov_len == 0) {
+				iov++;
+				iovcnt--;
+			}
+		}
+	}
+	return drained;
+}
+
+// Build the next batch of segments starting at the given position. The remote iovecs are built
+// in the first staging buffer and the local iovecs in local_iov. Returns the number of segments in
+// the batch and the total size.
+static int
+vector_build_batch(threadexec_t threadexec, const struct threadexec_iovec *iov, size_t count,
+		size_t segment, size_t offset, struct iovec *local_iov, size_t *batch_size) {
+	struct iovec *remote_iov = (struct iovec *) threadexec->staging;
+	size_t max_iovcnt = min(threadexec->staging_buffer_size / sizeof(struct iovec),
+			(size_t) IOV_MAX);
+	size_t total = 0;
+	int iovcnt = 0;
+	for (; segment < count && iovcnt < max_iovcnt && total < TX_VECTOR_BATCH_SIZE;
+			segment++, offset = 0) {
+		size_t size = min(iov[segment].size - offset, TX_VECTOR_BATCH_SIZE - total);
+		if (size == 0) {
+			continue;
+		}
+		remote_iov[iovcnt].iov_base = (uint8_t *) iov[segment].remote_address + offset;
+		remote_iov[iovcnt].iov_len  = size;
+		local_iov[iovcnt].iov_base  = (uint8_t *) iov[segment].data + offset;
+		local_iov[iovcnt].iov_len   = size;
+		total += size;
+		iovcnt++;
+	}
+	*batch_size = total;
+	return iovcnt;
+}
+
+// Perform a scatter-gather transfer. Each batch of segments is moved with a single remote call to
+// writev() (for reads) or readv() (for writes) on the shared pipe. Since the kernel copies the
+// data, a bad remote address produces a short transfer instead of a crash. We measure progress by
+// what actually passes through the pipe, and skip past any segment that makes no progress.
+static bool
+vector_transfer(threadexec_t threadexec, struct threadexec_iovec *iov, size_t count,
+		bool is_write) {
+	for (size_t i = 0; i < count; i++) {
+		iov[i].transferred = 0;
+	}
+	bool ok = vector_pipe_init(threadexec);
+	if (!ok) {
+		return false;
+	}
+	struct iovec local_iov[IOV_MAX];
+	bool complete = true;
+	size_t segment = 0;
+	while (segment < count) {
+		size_t offset = iov[segment].transferred;
+		size_t batch_size;
+		int iovcnt = vector_build_batch(threadexec, iov, count, segment, offset,
+				local_iov, &batch_size);
+		if (iovcnt == 0) {
+			break;
+		}
+		size_t moved;
+		if (is_write) {
+			// Fill the pipe, then have the remote thread scatter it into place. Anything
+			// left in the pipe afterwards was not consumed and is discarded.
+			ssize_t queued = writev(threadexec->vector_pipe[1], local_iov, iovcnt);
+			if (queued <= 0) {
+				ERROR_CALL(writev, "%d", errno);
+				return false;
+			}
+			ssize_t result;
+			ok = threadexec_call_cv(threadexec, &result, sizeof(result),
+					readv, 3,
+					TX_CARG_LITERAL(int, threadexec->vector_pipe_remote[0]),
+					TX_CARG_LITERAL(const struct iovec *,
+						threadexec->staging_remote),
+					TX_CARG_LITERAL(int, iovcnt));
+			if (!ok) {
+				ERROR_REMOTE_CALL(readv);
+				return false;
+			}
+			moved = queued - vector_pipe_drain(threadexec, NULL, 0);
+		} else {
+			// Have the remote thread gather the segments into the pipe, then read out
+			// whatever it managed to write.
+			ssize_t result;
+			ok = threadexec_call_cv(threadexec, &result, sizeof(result),
+					writev, 3,
+					TX_CARG_LITERAL(int, threadexec->vector_pipe_remote[1]),
+					TX_CARG_LITERAL(const struct iovec *,
+						threadexec->staging_remote),
+					TX_CARG_LITERAL(int, iovcnt));
+			if (!ok) {
+				ERROR_REMOTE_CALL(writev);
+				return false;
+			}
+			moved = vector_pipe_drain(threadexec, local_iov, iovcnt);
+		}
+		// Credit the bytes moved to the segments in order.
+		for (size_t left = moved; left > 0 && segment < count;) {
+			size_t step = min(left, iov[segment].size - iov[segment].transferred);
+			iov[segment].transferred += step;
+			left -= step;
+			if (iov[segment].transferred == iov[segment].size) {
+				segment++;
+			}
+		}
+		while (segment < count && iov[segment].transferred == iov[segment].size) {
+			segment++;
+		}
+		// If we made no progress, the current segment hit a bad address.
+		if (moved == 0 && segment < count) {
+			DEBUG_TRACE(1, "Scatter-gather segment %zu failed at %p", segment,
+					(uint8_t *) iov[segment].remote_address
+					+ iov[segment].transferred);
+			complete = false;
+			segment++;
+		}
+	}
+	return complete;
+}
+
+bool
+threadexec_readv(threadexec_t threadexec, struct threadexec_iovec *iov, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		bool ok = tx_write_buffer_flush_range(threadexec,
+				(word_t) iov[i].remote_address, iov[i].size);
+		if (!ok) {
+			return false;
+		}
+	}
+	return vector_transfer(threadexec, iov, count, false);
+}
+
+bool
+threadexec_writev(threadexec_t threadexec, struct threadexec_iovec *iov, size_t count) {
+	// Older pending writes must not land on top of these ones. This is a no-op when called to
+	// flush the write buffer itself.
+	bool ok = threadexec_write_buffer_flush(threadexec);
+	if (!ok) {
+		return false;
+	}
+	ok = vector_transfer(threadexec, iov, count, true);
+	for (size_t i = 0; i < count; i++) {
+		tx_read_cache_update(threadexec, (word_t) iov[i].remote_address,
+				(iov[i].transferred == iov[i].size ? iov[i].data : NULL),
+				iov[i].size);
+	}
+	return ok;
 }
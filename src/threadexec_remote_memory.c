@@ -0,0 +1,143 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_read_cache.h"
+#include "tx_utils.h"
+
+#include <CommonCrypto/CommonDigest.h>
+#include <assert.h>
+
+// The largest region we hand to a single remote call whose length parameter is 32 bits.
+#define MAX_CC_LONG_CHUNK 0x40000000
+
+bool
+threadexec_remote_memset(threadexec_t threadexec,
+		const void *remote_address, int value, size_t size) {
+	bool ok = threadexec_call_cv(threadexec, NULL, 0,
+			memset, 3,
+			TX_CARG_LITERAL(void *, remote_address),
+			TX_CARG_LITERAL(int, value),
+			TX_CARG_LITERAL(size_t, size));
+	if (!ok) {
+		ERROR_REMOTE_CALL(memset);
+	}
+	tx_read_cache_update(threadexec, (word_t) remote_address, NULL, size);
+	return ok;
+}
+
+bool
+threadexec_remote_memmove(threadexec_t threadexec,
+		const void *remote_destination, const void *remote_source, size_t size) {
+	bool ok = threadexec_call_cv(threadexec, NULL, 0,
+			memmove, 3,
+			TX_CARG_LITERAL(void *, remote_destination),
+			TX_CARG_LITERAL(const void *, remote_source),
+			TX_CARG_LITERAL(size_t, size));
+	if (!ok) {
+		ERROR_REMOTE_CALL(memmove);
+	}
+	tx_read_cache_update(threadexec, (word_t) remote_destination, NULL, size);
+	return ok;
+}
+
+bool
+threadexec_remote_memcmp(threadexec_t threadexec,
+		const void *remote_address_1, const void *remote_address_2, size_t size,
+		int *result) {
+	bool ok = threadexec_call_cv(threadexec, result, sizeof(*result),
+			memcmp, 3,
+			TX_CARG_LITERAL(const void *, remote_address_1),
+			TX_CARG_LITERAL(const void *, remote_address_2),
+			TX_CARG_LITERAL(size_t, size));
+	if (!ok) {
+		ERROR_REMOTE_CALL(memcmp);
+	}
+	return ok;
+}
+
+bool
+threadexec_remote_memmem(threadexec_t threadexec,
+		const void *remote_address, size_t size,
+		const void *pattern, size_t pattern_size, const void **found) {
+	// The pattern is staged in shared memory by threadexec_call_c(), which falls back to a
+	// temporary shared mapping for patterns that don't fit in the default region.
+	word_t match;
+	bool ok = threadexec_call_cv(threadexec, &match, sizeof(match),
+			memmem, 4,
+			TX_CARG_LITERAL(const void *, remote_address),
+			TX_CARG_LITERAL(size_t, size),
+			TX_CARG_PTR_DATA_IN(const void *, pattern, pattern_size),
+			TX_CARG_LITERAL(size_t, pattern_size));
+	if (!ok) {
+		ERROR_REMOTE_CALL(memmem);
+		return false;
+	}
+	*found = (const void *) match;
+	return true;
+}
+
+bool
+threadexec_remote_strlen(threadexec_t threadexec,
+		const char *remote_string, size_t max_length, size_t *length) {
+	bool ok = threadexec_call_cv(threadexec, length, sizeof(*length),
+			strnlen, 2,
+			TX_CARG_LITERAL(const char *, remote_string),
+			TX_CARG_LITERAL(size_t, max_length));
+	if (!ok) {
+		ERROR_REMOTE_CALL(strnlen);
+	}
+	return ok;
+}
+
+bool
+threadexec_remote_sha256(threadexec_t threadexec,
+		const void *remote_address, size_t size, uint8_t digest[32]) {
+	bool ok;
+	assert(CC_SHA256_DIGEST_LENGTH == 32);
+	// Most regions fit in a single call to CC_SHA256().
+	if (size <= MAX_CC_LONG_CHUNK) {
+		ok = threadexec_call_cv(threadexec, NULL, 0,
+				CC_SHA256, 3,
+				TX_CARG_LITERAL(const void *, remote_address),
+				TX_CARG_LITERAL(CC_LONG, size),
+				TX_CARG_PTR_DATA_OUT(unsigned char *, digest,
+					CC_SHA256_DIGEST_LENGTH));
+		if (!ok) {
+			ERROR_REMOTE_CALL(CC_SHA256);
+		}
+		return ok;
+	}
+	// Larger regions are hashed incrementally since the length is only 32 bits. The context
+	// round-trips through shared memory on each call but the data never leaves the task.
+	CC_SHA256_CTX context;
+	ok = threadexec_call_cv(threadexec, NULL, 0,
+			CC_SHA256_Init, 1,
+			TX_CARG_PTR_LITERAL_OUT(CC_SHA256_CTX *, &context));
+	if (!ok) {
+		ERROR_REMOTE_CALL(CC_SHA256_Init);
+		return false;
+	}
+	const uint8_t *address = remote_address;
+	while (size > 0) {
+		size_t chunk = min(size, (size_t) MAX_CC_LONG_CHUNK);
+		ok = threadexec_call_cv(threadexec, NULL, 0,
+				CC_SHA256_Update, 3,
+				TX_CARG_PTR_LITERAL_INOUT(CC_SHA256_CTX *, &context),
+				TX_CARG_LITERAL(const void *, address),
+				TX_CARG_LITERAL(CC_LONG, chunk));
+		if (!ok) {
+			ERROR_REMOTE_CALL(CC_SHA256_Update);
+			return false;
+		}
+		address += chunk;
+		size    -= chunk;
+	}
+	ok = threadexec_call_cv(threadexec, NULL, 0,
+			CC_SHA256_Final, 2,
+			TX_CARG_PTR_DATA_OUT(unsigned char *, digest, CC_SHA256_DIGEST_LENGTH),
+			TX_CARG_PTR_LITERAL_INOUT(CC_SHA256_CTX *, &context));
+	if (!ok) {
+		ERROR_REMOTE_CALL(CC_SHA256_Final);
+	}
+	return ok;
+}
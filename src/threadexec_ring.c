@@ -0,0 +1,276 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct threadexec_ring {
+	threadexec_t threadexec;
+	unsigned flags;
+	// The shared memory region holding the ring.
+	struct threadexec_ring_header *header;
+	const void *header_remote;
+	size_t size;
+	// The records, in the local mapping.
+	uint8_t *records;
+	size_t record_size;
+	uint64_t capacity;
+	// The local end of the doorbell port: a send right if the local task produces, or the
+	// receive right if it consumes. MACH_PORT_NULL if there is no doorbell.
+	mach_port_t doorbell;
+	mach_port_name_t doorbell_remote;
+};
+
+struct doorbell_msg {
+	mach_msg_header_t  hdr;
+};
+
+struct doorbell_msg_trailer {
+	mach_msg_header_t  hdr;
+	mach_msg_trailer_t trailer;
+};
+
+// Copy records between a local buffer and the ring slots starting at the specified index,
+// wrapping around the end of the ring.
+static void
+copy_records(struct threadexec_ring *ring, uint64_t index, void *data, size_t count,
+		bool to_ring) {
+	size_t slot  = index & (ring->capacity - 1);
+	size_t first = min(count, ring->capacity - slot);
+	uint8_t *local = data;
+	uint8_t *slots[2] = { ring->records + slot * ring->record_size, ring->records };
+	size_t sizes[2]   = { first * ring->record_size, (count - first) * ring->record_size };
+	for (size_t i = 0; i < 2; i++) {
+		if (to_ring) {
+			memcpy(slots[i], local, sizes[i]);
+		} else {
+			memcpy(local, slots[i], sizes[i]);
+		}
+		local += sizes[i];
+	}
+}
+
+// Create the doorbell port. Each ring has its own, so that a doorbell left over from a timed-out
+// wait can never be taken for a reply to another operation on the threadexec context's ports.
+static bool
+create_doorbell(struct threadexec_ring *ring) {
+	mach_port_t port = mach_port_allocate_receive_and_send();
+	if (port == MACH_PORT_NULL) {
+		ERROR("Could not allocate Mach port");
+		return false;
+	}
+	// The consumer holds the receive right. If that is the remote task, we keep only the send
+	// right.
+	mach_msg_type_name_t disposition = ((ring->flags & TX_RING_LOCAL_PRODUCER)
+			? MACH_MSG_TYPE_MOVE_RECEIVE
+			: MACH_MSG_TYPE_COPY_SEND);
+	bool ok = threadexec_mach_port_insert(ring->threadexec, port, &ring->doorbell_remote,
+			disposition);
+	if (!ok) {
+		ERROR("Could not insert doorbell port into remote task");
+		mach_port_destroy(mach_task_self(), port);
+		return false;
+	}
+	ring->doorbell = port;
+	return true;
+}
+
+static void
+destroy_doorbell(struct threadexec_ring *ring) {
+	kern_return_t kr;
+	bool ok = threadexec_call_cv(ring->threadexec, &kr, sizeof(kr),
+			mach_port_destroy, 2,
+			TX_CARG_LITERAL(task_t,      ring->threadexec->task_remote),
+			TX_CARG_LITERAL(mach_port_name_t, ring->doorbell_remote));
+	if (!ok) {
+		ERROR_REMOTE_CALL(mach_port_destroy);
+	}
+	mach_port_destroy(mach_task_self(), ring->doorbell);
+}
+
+// Wake the remote consumer if it is waiting for the doorbell.
+static void
+ring_doorbell(struct threadexec_ring *ring) {
+	struct threadexec_ring_header *header = ring->header;
+	// Order the store of head before the load of consumer_waiting, pairing with the fence in
+	// the consumer between setting consumer_waiting and rechecking head.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_exchange_n(&header->consumer_waiting, 0, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	struct doorbell_msg msg = {};
+	msg.hdr.msgh_bits        = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_COPY_SEND, 0, 0, 0);
+	msg.hdr.msgh_size        = sizeof(msg);
+	msg.hdr.msgh_remote_port = ring->doorbell;
+	msg.hdr.msgh_id          = TX_RING_DOORBELL_MSG_ID;
+	// If the queue is full, a doorbell is already pending, so don't block.
+	kern_return_t kr = mach_msg(&msg.hdr,
+			MACH_SEND_MSG | MACH_SEND_TIMEOUT,
+			sizeof(msg),
+			0,
+			MACH_PORT_NULL,
+			0,
+			MACH_PORT_NULL);
+	if (kr != KERN_SUCCESS && kr != MACH_SEND_TIMED_OUT) {
+		ERROR_CALL(mach_msg, "%u", kr);
+	}
+}
+
+bool
+threadexec_ring_create(threadexec_t threadexec, size_t record_size, size_t capacity,
+		unsigned flags, threadexec_ring_t *ring) {
+	if (record_size == 0 || capacity == 0 || capacity > UINT32_MAX / 2
+			|| record_size > UINT32_MAX) {
+		ERROR("Invalid ring geometry: %zu records of size %zu", capacity, record_size);
+		return false;
+	}
+	// Round the capacity up to a power of 2 so that slots can be found with a mask.
+	size_t rounded_capacity = 1;
+	while (rounded_capacity < capacity) {
+		rounded_capacity <<= 1;
+	}
+	if (rounded_capacity > SIZE_MAX / record_size) {
+		ERROR("Invalid ring geometry: %zu records of size %zu", capacity, record_size);
+		return false;
+	}
+	struct threadexec_ring *new_ring = calloc(1, sizeof(*new_ring));
+	assert(new_ring != NULL);
+	size_t size = mach_vm_round_page(sizeof(struct threadexec_ring_header)
+			+ rounded_capacity * record_size);
+	void *shmem;
+	const void *shmem_remote;
+	bool ok = threadexec_shared_vm_allocate(threadexec, &shmem_remote, &shmem, size);
+	if (!ok) {
+		ERROR("Could not allocate shared memory for ring");
+		free(new_ring);
+		return false;
+	}
+	struct threadexec_ring_header *header = shmem;
+	new_ring->threadexec    = threadexec;
+	new_ring->flags         = flags;
+	new_ring->header        = header;
+	new_ring->header_remote = shmem_remote;
+	new_ring->size          = size;
+	new_ring->records       = (uint8_t *) shmem + sizeof(*header);
+	new_ring->record_size   = record_size;
+	new_ring->capacity      = rounded_capacity;
+	if (flags & TX_RING_DOORBELL) {
+		ok = create_doorbell(new_ring);
+		if (!ok) {
+			threadexec_shared_vm_deallocate(threadexec, shmem_remote, shmem, size);
+			free(new_ring);
+			return false;
+		}
+	}
+	// The region is freshly allocated, so the indices and the waiting flag start at zero.
+	header->record_size   = (uint32_t) record_size;
+	header->capacity      = (uint32_t) rounded_capacity;
+	header->doorbell_port = new_ring->doorbell_remote;
+	*ring = new_ring;
+	return true;
+}
+
+const void *
+threadexec_ring_remote_address(threadexec_ring_t ring) {
+	return ring->header_remote;
+}
+
+size_t
+threadexec_ring_publish(threadexec_ring_t ring, const void *records, size_t count) {
+	assert(ring->flags & TX_RING_LOCAL_PRODUCER);
+	struct threadexec_ring_header *header = ring->header;
+	// We own head, so it doesn't need to be loaded atomically. Loading tail with acquire
+	// ordering makes sure the consumer is done with the slots it has freed.
+	uint64_t head = header->head;
+	uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+	count = min(count, ring->capacity - (head - tail));
+	if (count == 0) {
+		return 0;
+	}
+	copy_records(ring, head, (void *) records, count, true);
+	// Publish the whole batch at once.
+	__atomic_store_n(&header->head, head + count, __ATOMIC_RELEASE);
+	if (ring->flags & TX_RING_DOORBELL) {
+		ring_doorbell(ring);
+	}
+	return count;
+}
+
+size_t
+threadexec_ring_consume(threadexec_ring_t ring, void *records, size_t count) {
+	assert((ring->flags & TX_RING_LOCAL_PRODUCER) == 0);
+	struct threadexec_ring_header *header = ring->header;
+	uint64_t tail = header->tail;
+	uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	count = min(count, head - tail);
+	if (count == 0) {
+		return 0;
+	}
+	copy_records(ring, tail, records, count, false);
+	// Release the slots back to the producer only once we're done reading them.
+	__atomic_store_n(&header->tail, tail + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+// Check whether the ring has records to consume.
+static bool
+ring_has_records(struct threadexec_ring *ring) {
+	struct threadexec_ring_header *header = ring->header;
+	return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != header->tail;
+}
+
+bool
+threadexec_ring_wait(threadexec_ring_t ring, mach_msg_timeout_t timeout) {
+	assert((ring->flags & TX_RING_LOCAL_PRODUCER) == 0);
+	struct threadexec_ring_header *header = ring->header;
+	if (ring_has_records(ring) || (ring->flags & TX_RING_DOORBELL) == 0) {
+		return ring_has_records(ring);
+	}
+	for (;;) {
+		// Announce that we're about to block and then check again, so that a record published
+		// in between either is seen here or rings the doorbell.
+		__atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_has_records(ring)) {
+			__atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+			return true;
+		}
+		struct doorbell_msg_trailer msg;
+		kern_return_t kr = mach_msg(&msg.hdr,
+				MACH_RCV_MSG | (timeout != MACH_MSG_TIMEOUT_NONE ? MACH_RCV_TIMEOUT : 0),
+				0,
+				sizeof(msg),
+				ring->doorbell,
+				timeout,
+				MACH_PORT_NULL);
+		if (kr != KERN_SUCCESS) {
+			__atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+			if (kr != MACH_RCV_TIMED_OUT) {
+				ERROR_CALL(mach_msg, "%u", kr);
+			}
+			return ring_has_records(ring);
+		}
+		if (msg.hdr.msgh_id != TX_RING_DOORBELL_MSG_ID) {
+			ERROR("Received unexpected message ID %x on %s Mach port",
+					msg.hdr.msgh_id, "doorbell");
+			mach_msg_destroy(&msg.hdr);
+		}
+		// A doorbell may be left over from an earlier wait, so check before returning.
+		if (ring_has_records(ring)) {
+			return true;
+		}
+	}
+}
+
+void
+threadexec_ring_free(threadexec_ring_t ring) {
+	if (ring->flags & TX_RING_DOORBELL) {
+		destroy_doorbell(ring);
+	}
+	threadexec_shared_vm_deallocate(ring->threadexec, ring->header_remote, ring->header,
+			ring->size);
+	free(ring);
+}
@@ -0,0 +1,145 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_prototypes.h"
+#include "tx_read_cache.h"
+#include "tx_utils.h"
+#include "tx_write_buffer.h"
+
+#include <assert.h>
+
+// Safe memory access uses the kernel to copy memory instead of memcpy(). The kernel validates the
+// remote addresses, so a bad address produces an error instead of a crash.
+
+// Copy a single chunk of at most one staging buffer with the kernel.
+static kern_return_t
+safe_copy_chunk(threadexec_t threadexec, word_t remote_address, uint8_t *data, size_t size,
+		bool is_write) {
+	kern_return_t kr;
+	if (tx_supports_task_api(threadexec)) {
+		if (is_write) {
+			kr = mach_vm_write(threadexec->task, remote_address,
+					(vm_offset_t) data, (mach_msg_type_number_t) size);
+		} else {
+			mach_vm_size_t out_size;
+			kr = mach_vm_read_overwrite(threadexec->task, remote_address, size,
+					(mach_vm_address_t) data, &out_size);
+		}
+		return kr;
+	}
+	// Have the remote thread call into the kernel on its own task, using the first staging
+	// buffer for the data. There are always at least two staging buffers.
+	assert(size <= threadexec->staging_buffer_size);
+	bool ok;
+	if (is_write) {
+		memcpy(threadexec->staging, data, size);
+		ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+				mach_vm_write, 4,
+				TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+				TX_CARG_LITERAL(mach_vm_address_t, remote_address),
+				TX_CARG_LITERAL(vm_offset_t, threadexec->staging_remote),
+				TX_CARG_LITERAL(mach_msg_type_number_t, size));
+	} else {
+		// The out-size goes in the second staging buffer. A pointer argument would be staged
+		// at the start of the first one, where the kernel would write it over the data.
+		word_t out_size_remote = threadexec->staging_remote + threadexec->staging_buffer_size;
+		ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+				mach_vm_read_overwrite, 5,
+				TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+				TX_CARG_LITERAL(mach_vm_address_t, remote_address),
+				TX_CARG_LITERAL(mach_vm_size_t, size),
+				TX_CARG_LITERAL(mach_vm_address_t, threadexec->staging_remote),
+				TX_CARG_LITERAL(mach_vm_size_t *, out_size_remote));
+		if (ok && kr == KERN_SUCCESS) {
+			memcpy(data, threadexec->staging, size);
+		}
+	}
+	if (!ok) {
+		ERROR("Could not call %s in remote thread",
+				(is_write ? "mach_vm_write" : "mach_vm_read_overwrite"));
+		return KERN_FAILURE;
+	}
+	return kr;
+}
+
+// Copy a chunk that failed as a whole page by page, to find how much of it can be copied.
+static size_t
+safe_copy_partial(threadexec_t threadexec, word_t remote_address, uint8_t *data, size_t size,
+		bool is_write) {
+	size_t done = 0;
+	while (done < size) {
+		word_t address = remote_address + done;
+		size_t step = min(size - done, (size_t) (mach_vm_trunc_page(address) + vm_page_size
+					- address));
+		kern_return_t kr = safe_copy_chunk(threadexec, address, data + done, step,
+				is_write);
+		if (kr != KERN_SUCCESS) {
+			DEBUG_TRACE(1, "Safe %s failed at %p: %u", (is_write ? "write" : "read"),
+					(void *) address, kr);
+			break;
+		}
+		done += step;
+	}
+	return done;
+}
+
+bool
+tx_safe_transfer(threadexec_t threadexec, word_t remote_address, void *data, size_t size,
+		bool is_write, size_t *transferred) {
+	// With the task API there's no staging buffer to limit us, so try the whole range at
+	// once.
+	size_t chunk_size = size;
+	if (!tx_supports_task_api(threadexec)) {
+		chunk_size = threadexec->staging_buffer_size;
+	}
+	uint8_t *local = data;
+	size_t done = 0;
+	while (done < size) {
+		size_t chunk = min(size - done, chunk_size);
+		kern_return_t kr = safe_copy_chunk(threadexec, remote_address + done, local + done,
+				chunk, is_write);
+		if (kr != KERN_SUCCESS) {
+			done += safe_copy_partial(threadexec, remote_address + done, local + done,
+					chunk, is_write);
+			break;
+		}
+		done += chunk;
+	}
+	if (transferred != NULL) {
+		*transferred = done;
+	}
+	return (done == size);
+}
+
+bool
+threadexec_read_safe(threadexec_t threadexec, const void *remote_address, void *data,
+		size_t size, size_t *copied) {
+	bool ok = tx_write_buffer_flush_range(threadexec, (word_t) remote_address, size);
+	if (!ok) {
+		if (copied != NULL) {
+			*copied = 0;
+		}
+		return false;
+	}
+	return tx_safe_transfer(threadexec, (word_t) remote_address, data, size, false, copied);
+}
+
+bool
+threadexec_write_safe(threadexec_t threadexec, const void *remote_address, const void *data,
+		size_t size, size_t *copied) {
+	size_t done = 0;
+	bool ok = tx_write_buffer_flush_range(threadexec, (word_t) remote_address, size);
+	if (ok) {
+		ok = tx_safe_transfer(threadexec, (word_t) remote_address, (void *) data, size,
+				true, &done);
+	}
+	// Keep the read cache coherent with the part that was written.
+	tx_read_cache_update(threadexec, (word_t) remote_address, data, done);
+	if (done < size) {
+		tx_read_cache_update(threadexec, (word_t) remote_address + done, NULL, size - done);
+	}
+	if (copied != NULL) {
+		*copied = done;
+	}
+	return ok;
+}
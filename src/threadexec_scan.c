@@ -0,0 +1,309 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A growable array of hits.
+struct hit_list {
+	struct threadexec_scan_hit *hits;
+	size_t count;
+	size_t capacity;
+};
+
+// A chunk of a snapshotted region to be scanned by a single worker.
+struct scan_chunk {
+	const struct threadexec_vm_region *region;
+	// The local view of the whole region.
+	const uint8_t *local;
+	// The range of the region covered by this chunk.
+	size_t offset;
+	size_t size;
+};
+
+// The chunks of one batch of snapshots, shared by the workers.
+struct scan_batch {
+	const struct threadexec_scan_pattern *patterns;
+	size_t pattern_count;
+	const struct scan_chunk *chunks;
+	size_t chunk_count;
+	pthread_mutex_t lock;
+	// The index of the next chunk to be claimed. Protected by lock.
+	size_t next_chunk;
+	// The hits found so far. Protected by lock.
+	struct hit_list *hits;
+};
+
+static void
+hit_list_reserve(struct hit_list *list, size_t count) {
+	if (list->count + count > list->capacity) {
+		list->capacity = max(2 * list->capacity, list->count + count);
+		list->capacity = max(list->capacity, (size_t) 16);
+		list->hits = realloc(list->hits, list->capacity * sizeof(*list->hits));
+		assert(list->hits != NULL);
+	}
+}
+
+static void
+hit_list_append(struct hit_list *list, word_t remote_address, size_t pattern_index,
+		const struct threadexec_vm_region *region) {
+	hit_list_reserve(list, 1);
+	struct threadexec_scan_hit *hit = &list->hits[list->count++];
+	hit->remote_address = (const void *) remote_address;
+	hit->pattern_index  = pattern_index;
+	hit->region         = *region;
+}
+
+static int
+hit_compare(const void *a, const void *b) {
+	const struct threadexec_scan_hit *hit_a = a, *hit_b = b;
+	if (hit_a->remote_address != hit_b->remote_address) {
+		return (hit_a->remote_address < hit_b->remote_address ? -1 : 1);
+	}
+	if (hit_a->pattern_index != hit_b->pattern_index) {
+		return (hit_a->pattern_index < hit_b->pattern_index ? -1 : 1);
+	}
+	return 0;
+}
+
+// Search a chunk of a local view for every pattern.
+static void
+scan_chunk(const struct scan_batch *batch, const struct scan_chunk *chunk,
+		struct hit_list *hits) {
+	const struct threadexec_vm_region *region = chunk->region;
+	for (size_t p = 0; p < batch->pattern_count; p++) {
+		const struct threadexec_scan_pattern *pattern = &batch->patterns[p];
+		// Search up to pattern->size - 1 bytes past the end of the chunk so that matches
+		// straddling the boundary are found. A match found this way always starts inside
+		// the chunk, so no match is reported twice.
+		const uint8_t *start = chunk->local + chunk->offset;
+		const uint8_t *end   = chunk->local
+			+ min(region->size, chunk->offset + chunk->size + pattern->size - 1);
+		// The libc memmem() is vectorized, so it is hard to beat for a handful of
+		// patterns.
+		while ((size_t) (end - start) >= pattern->size) {
+			const uint8_t *match = memmem(start, end - start,
+					pattern->data, pattern->size);
+			if (match == NULL) {
+				break;
+			}
+			hit_list_append(hits, (word_t) region->address + (match - chunk->local), p,
+					region);
+			start = match + 1;
+		}
+	}
+}
+
+static void *
+scan_worker(void *context) {
+	struct scan_batch *batch = context;
+	struct hit_list hits = {};
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		size_t index = batch->next_chunk;
+		if (index < batch->chunk_count) {
+			batch->next_chunk++;
+		}
+		pthread_mutex_unlock(&batch->lock);
+		if (index >= batch->chunk_count) {
+			break;
+		}
+		scan_chunk(batch, &batch->chunks[index], &hits);
+	}
+	// Merge our hits into the batch's list once, rather than taking the lock for every hit.
+	if (hits.count > 0) {
+		pthread_mutex_lock(&batch->lock);
+		hit_list_reserve(batch->hits, hits.count);
+		memcpy(batch->hits->hits + batch->hits->count, hits.hits,
+				hits.count * sizeof(*hits.hits));
+		batch->hits->count += hits.count;
+		pthread_mutex_unlock(&batch->lock);
+	}
+	free(hits.hits);
+	return NULL;
+}
+
+// Scan the chunks of a batch using up to thread_count threads, including this one.
+static void
+scan_batch_run(struct scan_batch *batch, unsigned thread_count) {
+	size_t worker_count = min((size_t) thread_count, batch->chunk_count);
+	pthread_t *workers = NULL;
+	size_t started = 0;
+	if (worker_count > 1) {
+		workers = malloc((worker_count - 1) * sizeof(*workers));
+		assert(workers != NULL);
+		for (; started < worker_count - 1; started++) {
+			int err = pthread_create(&workers[started], NULL, scan_worker, batch);
+			if (err != 0) {
+				DEBUG_TRACE(1, "pthread_create: %d", err);
+				break;
+			}
+		}
+	}
+	scan_worker(batch);
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+}
+
+// Search a region in the remote task. Only the match addresses are transferred.
+static void
+scan_remote(threadexec_t threadexec, const struct threadexec_scan_pattern *patterns,
+		size_t pattern_count, const struct threadexec_vm_region *region,
+		struct hit_list *hits) {
+	if (threadexec->flags & TX_SAFE_MEMORY_ACCESS) {
+		ERROR("Could not scan remote region %p-%p", region->address,
+				(void *) ((word_t) region->address + region->size));
+		return;
+	}
+	const word_t end = (word_t) region->address + region->size;
+	for (size_t p = 0; p < pattern_count; p++) {
+		word_t address = (word_t) region->address;
+		while (end - address >= patterns[p].size) {
+			const void *found;
+			bool ok = threadexec_remote_memmem(threadexec, (const void *) address,
+					end - address, patterns[p].data, patterns[p].size, &found);
+			if (!ok || found == NULL) {
+				break;
+			}
+			hit_list_append(hits, (word_t) found, p, region);
+			address = (word_t) found + 1;
+		}
+	}
+}
+
+// Snapshot a batch of ranges. If the batch can't be snapshotted together, each range is tried on
+// its own, and the ranges that still fail are left with a NULL local address.
+static void
+snapshot_batch(threadexec_t threadexec, struct threadexec_snapshot_range *ranges, size_t count) {
+	bool ok = threadexec_snapshot_region(threadexec, ranges, count, false);
+	if (ok) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		ok = threadexec_snapshot_region(threadexec, &ranges[i], 1, false);
+		if (!ok) {
+			ranges[i].local_address = NULL;
+		}
+	}
+}
+
+bool
+threadexec_scan(threadexec_t threadexec,
+		const struct threadexec_scan_pattern *patterns, size_t pattern_count,
+		unsigned thread_count, struct threadexec_scan_hit **hits, size_t *hit_count) {
+	bool success = false;
+	for (size_t p = 0; p < pattern_count; p++) {
+		if (patterns[p].size == 0) {
+			ERROR("Scan pattern %zu is empty", p);
+			goto fail_0;
+		}
+	}
+	if (thread_count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = (cpus > 0 ? cpus : 1);
+	}
+	// Copy the region map, since the cached one may be refreshed during the scan.
+	const struct threadexec_vm_region *map;
+	size_t count;
+	bool ok = threadexec_vm_regions(threadexec, true, &map, &count);
+	if (!ok) {
+		ERROR("Could not enumerate remote memory regions");
+		goto fail_0;
+	}
+	struct threadexec_vm_region *regions = malloc(count * sizeof(*regions) + 1);
+	struct threadexec_snapshot_range *ranges = malloc(count * sizeof(*ranges) + 1);
+	size_t *range_regions = malloc(count * sizeof(*range_regions) + 1);
+	assert(regions != NULL && ranges != NULL && range_regions != NULL);
+	memcpy(regions, map, count * sizeof(*regions));
+	struct hit_list all_hits = {};
+	struct scan_chunk *chunks = NULL;
+	size_t chunk_capacity = 0;
+	struct scan_batch batch = {
+		.patterns      = patterns,
+		.pattern_count = pattern_count,
+		.hits          = &all_hits,
+	};
+	pthread_mutex_init(&batch.lock, NULL);
+	size_t next_region = 0;
+	while (next_region < count) {
+		// Gather readable regions until the batch is full. Each batch is a single
+		// snapshot, so the local address space used is bounded.
+		size_t range_count = 0;
+		size_t batch_size = 0;
+		for (; next_region < count && batch_size < TX_SCAN_BATCH_SIZE; next_region++) {
+			const struct threadexec_vm_region *region = &regions[next_region];
+			if (!(region->protection & VM_PROT_READ)) {
+				continue;
+			}
+			// Skip our own shared memory. The staging buffers hold whatever was last
+			// written or passed to a call, including the patterns themselves if we
+			// fall back to searching remotely.
+			if (tx_shared_vm_owns(threadexec, (word_t) region->address,
+						region->size)) {
+				continue;
+			}
+			ranges[range_count].remote_address = region->address;
+			ranges[range_count].size           = region->size;
+			range_regions[range_count]         = next_region;
+			range_count++;
+			batch_size += region->size;
+		}
+		if (range_count == 0) {
+			break;
+		}
+		snapshot_batch(threadexec, ranges, range_count);
+		// Split the snapshotted regions into chunks for the workers. Regions we couldn't
+		// map are searched remotely instead.
+		size_t chunk_count = 0;
+		for (size_t i = 0; i < range_count; i++) {
+			const struct threadexec_vm_region *region = &regions[range_regions[i]];
+			if (ranges[i].local_address == NULL) {
+				scan_remote(threadexec, patterns, pattern_count, region, &all_hits);
+				continue;
+			}
+			for (size_t offset = 0; offset < region->size; offset += TX_SCAN_CHUNK_SIZE) {
+				if (chunk_count == chunk_capacity) {
+					chunk_capacity = max(2 * chunk_capacity, (size_t) 64);
+					chunks = realloc(chunks, chunk_capacity * sizeof(*chunks));
+					assert(chunks != NULL);
+				}
+				struct scan_chunk *chunk = &chunks[chunk_count++];
+				chunk->region = region;
+				chunk->local  = ranges[i].local_address;
+				chunk->offset = offset;
+				chunk->size   = min(region->size - offset, (size_t) TX_SCAN_CHUNK_SIZE);
+			}
+		}
+		batch.chunks      = chunks;
+		batch.chunk_count = chunk_count;
+		batch.next_chunk  = 0;
+		scan_batch_run(&batch, thread_count);
+		for (size_t i = 0; i < range_count; i++) {
+			if (ranges[i].local_address != NULL) {
+				threadexec_snapshot_release(&ranges[i], 1);
+			}
+		}
+	}
+	pthread_mutex_destroy(&batch.lock);
+	if (all_hits.count > 0) {
+		qsort(all_hits.hits, all_hits.count, sizeof(*all_hits.hits), hit_compare);
+	}
+	DEBUG_TRACE(1, "Found %zu matches for %zu patterns", all_hits.count, pattern_count);
+	*hits      = all_hits.hits;
+	*hit_count = all_hits.count;
+	success = true;
+	free(chunks);
+	free(range_regions);
+	free(ranges);
+	free(regions);
+fail_0:
+	return success;
+}
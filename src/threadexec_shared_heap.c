@@ -0,0 +1,207 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// Size classes are powers of 2 from 1 << MIN_CLASS_SHIFT to 1 << MAX_CLASS_SHIFT bytes,
+// including the block header.
+#define MIN_CLASS_SHIFT 4
+#define MAX_CLASS_SHIFT 20
+#define CLASS_COUNT (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1)
+
+#define HEAP_MAGIC  0x70616568786574ULL
+#define BLOCK_MAGIC 0x6b6c6278
+
+// The heap metadata, at the start of the shared region. Everything is referred to by its offset
+// from the start of the region so that it means the same thing in both tasks.
+struct heap_header {
+	uint64_t magic;
+	uint64_t size;
+	// The offset of the first byte that has never been allocated.
+	uint64_t brk;
+	// The free list heads. Each is the offset of the first free block in the low 32 bits and
+	// a generation count in the high 32 bits, which is bumped on every update so that a
+	// compare-and-swap can't succeed against a list that changed and changed back.
+	uint64_t free_lists[CLASS_COUNT];
+};
+
+// The header before each block.
+struct block_header {
+	uint32_t size_class;
+	uint32_t magic;
+	// While the block is free, the offset of the next free block, or 0.
+	uint64_t next;
+};
+
+struct threadexec_shared_heap {
+	threadexec_t threadexec;
+	uint8_t *local;
+	word_t remote;
+	size_t size;
+};
+
+static struct heap_header *
+heap_header(struct threadexec_shared_heap *heap) {
+	return (struct heap_header *) heap->local;
+}
+
+static struct block_header *
+block_at(struct threadexec_shared_heap *heap, uint64_t offset) {
+	return (struct block_header *) (heap->local + offset);
+}
+
+static uint64_t
+list_entry(uint64_t generation, uint64_t offset) {
+	return (generation << 32) | offset;
+}
+
+// Pop a block off a free list. Returns 0 if the list is empty.
+static uint64_t
+free_list_pop(struct threadexec_shared_heap *heap, unsigned size_class) {
+	uint64_t *head = &heap_header(heap)->free_lists[size_class];
+	uint64_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint64_t offset = (uint32_t) old;
+		if (offset == 0) {
+			return 0;
+		}
+		// The block may be popped by someone else before our compare-and-swap, in which case
+		// next is stale, but then the generation has changed and the swap fails.
+		uint64_t next = __atomic_load_n(&block_at(heap, offset)->next, __ATOMIC_RELAXED);
+		uint64_t new = list_entry((old >> 32) + 1, next);
+		if (__atomic_compare_exchange_n(head, &old, new, true,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			return offset;
+		}
+	}
+}
+
+static void
+free_list_push(struct threadexec_shared_heap *heap, unsigned size_class, uint64_t offset) {
+	uint64_t *head = &heap_header(heap)->free_lists[size_class];
+	struct block_header *block = block_at(heap, offset);
+	uint64_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+	for (;;) {
+		__atomic_store_n(&block->next, (uint32_t) old, __ATOMIC_RELAXED);
+		uint64_t new = list_entry((old >> 32) + 1, offset);
+		if (__atomic_compare_exchange_n(head, &old, new, true,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return;
+		}
+	}
+}
+
+// Carve a new block of the specified size from the unallocated part of the heap. Returns 0 if
+// the heap is exhausted.
+static uint64_t
+carve_block(struct threadexec_shared_heap *heap, size_t block_size) {
+	uint64_t *brk = &heap_header(heap)->brk;
+	uint64_t old = __atomic_load_n(brk, __ATOMIC_RELAXED);
+	do {
+		if (old + block_size > heap->size) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(brk, &old, old + block_size, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return old;
+}
+
+bool
+threadexec_shared_heap_create(threadexec_t threadexec, size_t size,
+		threadexec_shared_heap_t *heap) {
+	size = mach_vm_round_page(size);
+	if (size <= sizeof(struct heap_header) || size > UINT32_MAX) {
+		ERROR("Invalid shared heap size %zu", size);
+		return false;
+	}
+	void *local;
+	const void *remote;
+	bool ok = threadexec_shared_vm_allocate(threadexec, &remote, &local, size);
+	if (!ok) {
+		ERROR("Could not allocate shared memory for shared heap");
+		return false;
+	}
+	struct threadexec_shared_heap *new_heap = malloc(sizeof(*new_heap));
+	assert(new_heap != NULL);
+	new_heap->threadexec = threadexec;
+	new_heap->local      = local;
+	new_heap->remote     = (word_t) remote;
+	new_heap->size       = size;
+	// The region is freshly allocated and zeroed, so the free lists start out empty. Blocks
+	// start on a 16-byte boundary after the header.
+	struct heap_header *header = heap_header(new_heap);
+	header->magic = HEAP_MAGIC;
+	header->size  = size;
+	header->brk   = (sizeof(*header) + 15) & ~(uint64_t) 15;
+	*heap = new_heap;
+	return true;
+}
+
+void
+threadexec_shared_heap_destroy(threadexec_shared_heap_t heap) {
+	threadexec_shared_vm_deallocate(heap->threadexec, (const void *) heap->remote, heap->local,
+			heap->size);
+	free(heap);
+}
+
+bool
+threadexec_shared_heap_alloc(threadexec_shared_heap_t heap, size_t size,
+		void **local_address, const void **remote_address) {
+	size_t block_size = size + sizeof(struct block_header);
+	if (block_size > ((size_t) 1 << MAX_CLASS_SHIFT)) {
+		ERROR("Shared heap allocation of size %zu is too large", size);
+		return false;
+	}
+	unsigned size_class = 0;
+	while (((size_t) 1 << (size_class + MIN_CLASS_SHIFT)) < block_size) {
+		size_class++;
+	}
+	// Reuse a freed block if there is one, otherwise carve a new one.
+	uint64_t offset = free_list_pop(heap, size_class);
+	if (offset == 0) {
+		offset = carve_block(heap, (size_t) 1 << (size_class + MIN_CLASS_SHIFT));
+		if (offset == 0) {
+			DEBUG_TRACE(1, "Shared heap exhausted allocating %zu bytes", size);
+			return false;
+		}
+	}
+	struct block_header *block = block_at(heap, offset);
+	block->size_class = size_class;
+	block->magic      = BLOCK_MAGIC;
+	uint64_t data = offset + sizeof(*block);
+	*local_address = heap->local + data;
+	if (remote_address != NULL) {
+		*remote_address = (const void *) (heap->remote + data);
+	}
+	return true;
+}
+
+void
+threadexec_shared_heap_free(threadexec_shared_heap_t heap, void *local_address) {
+	if (local_address == NULL) {
+		return;
+	}
+	uint64_t offset = (uint8_t *) local_address - heap->local - sizeof(struct block_header);
+	assert(offset < heap->size);
+	struct block_header *block = block_at(heap, offset);
+	assert(block->magic == BLOCK_MAGIC && block->size_class < CLASS_COUNT);
+	block->magic = 0;
+	free_list_push(heap, block->size_class, offset);
+}
+
+const void *
+threadexec_shared_heap_remote_address(threadexec_shared_heap_t heap,
+		const void *local_address) {
+	return (const void *) (heap->remote + ((const uint8_t *) local_address - heap->local));
+}
+
+void *
+threadexec_shared_heap_local_address(threadexec_shared_heap_t heap, const void *remote_address) {
+	word_t offset = (word_t) remote_address - heap->remote;
+	if (offset >= heap->size) {
+		return NULL;
+	}
+	return heap->local + offset;
+}
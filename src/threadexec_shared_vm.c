@@ -1,9 +1,15 @@
 #include "tx_internal.h"
 
 #include "tx_log.h"
+#include "tx_params.h"
 #include "tx_prototypes.h"
+#include "tx_shared_vm_pool.h"
+#include "tx_utils.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 void
 threadexec_shared_vm_default(threadexec_t threadexec,
@@ -19,17 +25,24 @@ threadexec_shared_vm_default(threadexec_t threadexec,
 	}
 }
 
+// Get the alignment mask for mapping shared memory in the remote task. Regions that were
+// requested with superpages are aligned so that the remote mapping can use them too.
+static mach_vm_offset_t
+map_alignment_mask(size_t size, bool superpage) {
+	return (superpage && size % TX_SUPERPAGE_SIZE == 0 ? TX_SUPERPAGE_SIZE - 1 : 0);
+}
+
 // Try to map the shared memory into the remote task using the Mach task APIs.
 // NOTE: This routine does not need any further initialization than the task port.
 static bool
 map_shared_memory_with_task_api(threadexec_t threadexec, mach_port_t memory_entry, size_t size,
-		const void **remote_address) {
+		bool superpage, const void **remote_address) {
 	assert(tx_supports_task_api(threadexec));
 	mach_vm_address_t remote_map_address = 0;
 	kern_return_t kr = mach_vm_map(threadexec->task,
 			&remote_map_address,
 			size,
-			0,
+			map_alignment_mask(size, superpage),
 			VM_FLAGS_ANYWHERE,
 			memory_entry,
 			0,
@@ -50,7 +63,7 @@ map_shared_memory_with_task_api(threadexec_t threadexec, mach_port_t memory_entr
 // NOTE: This routine needs Mach ports and shmem to already be initialized.
 static bool
 map_shared_memory_with_thread_api(threadexec_t threadexec, mach_port_t memory_entry, size_t size,
-		const void **remote_address) {
+		bool superpage, const void **remote_address) {
 	bool success = false;
 	// Send the memory entry to the remote thread.
 	mach_port_name_t remote_memory_entry;
@@ -66,7 +79,7 @@ map_shared_memory_with_thread_api(threadexec_t threadexec, mach_port_t memory_en
 		TX_ARG(vm_map_t,               threadexec->task_remote),
 		TX_ARG(mach_vm_address_t *,    remote_address_out),
 		TX_ARG(mach_vm_size_t,         size),
-		TX_ARG(mach_vm_offset_t,       0),
+		TX_ARG(mach_vm_offset_t,       map_alignment_mask(size, superpage)),
 		TX_ARG(int,                    VM_FLAGS_ANYWHERE),
 		TX_ARG(mem_entry_name_port_t,  remote_memory_entry),
 		TX_ARG(memory_object_offset_t, 0),
@@ -100,23 +113,45 @@ fail_0:
 
 #endif // TX_HAVE_THREAD_API
 
+bool
+tx_shared_vm_map_entry(threadexec_t threadexec, mach_port_t memory_entry, size_t size,
+		bool superpage, const void **remote_address) {
+	// Prefer the task API but default to the thread API.
+	bool ok;
+	if (tx_supports_task_api(threadexec)) {
+		ok = map_shared_memory_with_task_api(threadexec, memory_entry, size, superpage,
+				remote_address);
+		if (ok) {
+			return true;
+		}
+	}
+#if TX_HAVE_THREAD_API
+	ok = map_shared_memory_with_thread_api(threadexec, memory_entry, size, superpage,
+			remote_address);
+	if (ok) {
+		return true;
+	}
+#endif
+	return false;
+}
+
 // NOTE: If the threadexec supports the task API, then only the task port needs to be initialized.
 bool
-threadexec_shared_vm_allocate(threadexec_t threadexec,
-		const void **remote_address, void **local_address, size_t size) {
+tx_shared_vm_allocate(threadexec_t threadexec, const void **remote_address,
+		void **local_address, size_t size, unsigned flags) {
 	bool success = false;
-	// First allocate some memory locally.
+	// First allocate some memory locally. Superpages are a best effort: the allocation falls
+	// back to regular pages if it can't get them.
+	bool superpage = ((flags & TX_SHARED_VM_SUPERPAGE) != 0);
 	mach_vm_address_t local_vm_address;
-	kern_return_t kr = mach_vm_allocate(mach_task_self(), &local_vm_address, size,
-			VM_FLAGS_ANYWHERE);
-	if (kr != KERN_SUCCESS) {
-		ERROR_CALL(mach_vm_allocate, "%u", kr);
+	bool ok = mach_vm_allocate_local(&local_vm_address, size, superpage);
+	if (!ok) {
 		goto fail_0;
 	}
 	// Create a memory entry for this allocation.
 	memory_object_size_t mo_size = size;
 	mach_port_t memory_entry = MACH_PORT_NULL;
-	kr = mach_make_memory_entry_64(mach_task_self(), &mo_size,
+	kern_return_t kr = mach_make_memory_entry_64(mach_task_self(), &mo_size,
 			(memory_object_offset_t) local_vm_address, VM_PROT_DEFAULT, &memory_entry,
 			MACH_PORT_NULL);
 	if (kr != KERN_SUCCESS) {
@@ -124,25 +159,12 @@ threadexec_shared_vm_allocate(threadexec_t threadexec,
 		goto fail_1;
 	}
 	DEBUG_TRACE(1, "memory_entry = %x", memory_entry);
-	// Try to map this memory entry in the remote task. Prefer the task API but default to the
-	// thread API.
-	bool ok;
-	if (tx_supports_task_api(threadexec)) {
-		ok = map_shared_memory_with_task_api(threadexec, memory_entry, size,
-				remote_address);
-		if (ok) {
-			goto success;
-		}
-	}
-#if TX_HAVE_THREAD_API
-	ok = map_shared_memory_with_thread_api(threadexec, memory_entry, size, remote_address);
-	if (ok) {
-		goto success;
+	// Try to map this memory entry in the remote task.
+	ok = tx_shared_vm_map_entry(threadexec, memory_entry, size, superpage, remote_address);
+	if (!ok) {
+		goto fail_2;
 	}
-#endif
-	goto fail_2;
 	// Success!
-success:
 	*local_address  = (void *) local_vm_address;
 	success = true;
 fail_2:
@@ -155,6 +177,243 @@ fail_0:
 	return success;
 }
 
+// Find the index of the last registered mapping that starts at or below the local address, or
+// the mapping count if there is none.
+static size_t
+find_mapping(threadexec_t threadexec, const uint8_t *local_address) {
+	size_t low = 0;
+	size_t high = threadexec->shared_mapping_count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (threadexec->shared_mappings[mid].local <= local_address) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return (low > 0 ? low - 1 : threadexec->shared_mapping_count);
+}
+
+static void
+register_mapping(threadexec_t threadexec, word_t remote_address, void *local_address,
+		size_t size) {
+	size_t count = threadexec->shared_mapping_count;
+	// Insert the mapping after every mapping below it to keep the array sorted.
+	size_t index = find_mapping(threadexec, local_address);
+	index = (index == count ? 0 : index + 1);
+	struct tx_shared_mapping *mappings = realloc(threadexec->shared_mappings,
+			(count + 1) * sizeof(*mappings));
+	assert(mappings != NULL);
+	memmove(&mappings[index + 1], &mappings[index], (count - index) * sizeof(*mappings));
+	mappings[index].local  = local_address;
+	mappings[index].remote = remote_address;
+	mappings[index].size   = size;
+	threadexec->shared_mappings      = mappings;
+	threadexec->shared_mapping_count = count + 1;
+}
+
+static void
+unregister_mapping(threadexec_t threadexec, void *local_address) {
+	size_t count = threadexec->shared_mapping_count;
+	size_t index = find_mapping(threadexec, local_address);
+	if (index == count || threadexec->shared_mappings[index].local != local_address) {
+		return;
+	}
+	struct tx_shared_mapping *mappings = threadexec->shared_mappings;
+	memmove(&mappings[index], &mappings[index + 1], (count - index - 1) * sizeof(*mappings));
+	threadexec->shared_mapping_count = count - 1;
+}
+
+bool
+threadexec_shared_vm_allocate_flags(threadexec_t threadexec,
+		const void **remote_address, void **local_address, size_t size, unsigned flags) {
+	bool ok = tx_shared_vm_allocate(threadexec, remote_address, local_address, size, flags);
+	if (ok) {
+		register_mapping(threadexec, (word_t) *remote_address, *local_address, size);
+	}
+	return ok;
+}
+
+bool
+threadexec_shared_vm_allocate(threadexec_t threadexec,
+		const void **remote_address, void **local_address, size_t size) {
+	return threadexec_shared_vm_allocate_flags(threadexec, remote_address, local_address,
+			size, 0);
+}
+
+// Call mlock() or munlock() on a range in the remote task.
+static bool
+remote_mlock(threadexec_t threadexec, const void *remote_address, size_t size, bool lock) {
+	int ret;
+	bool ok = threadexec_call_cv(threadexec, &ret, sizeof(ret),
+			(lock ? (void *) mlock : (void *) munlock), 2,
+			TX_CARG_LITERAL(const void *, remote_address),
+			TX_CARG_LITERAL(size_t, size));
+	if (!ok) {
+		ERROR("Could not call %s in remote thread", (lock ? "mlock" : "munlock"));
+		return false;
+	}
+	return (ret == 0);
+}
+
+bool
+tx_shared_vm_prefault(threadexec_t threadexec, const void *remote_address,
+		void *local_address, size_t size, bool wire, bool *wired) {
+	// Locally, writing each page back to itself is enough to fault it in without changing it.
+	volatile uint8_t *local = local_address;
+	for (size_t offset = 0; offset < size; offset += vm_page_size) {
+		local[offset] = local[offset];
+	}
+	// We can't touch the pages in the remote task without disturbing the remote thread's
+	// registers, but mlock() faults them in, and they stay resident after munlock().
+	bool remote_locked = remote_mlock(threadexec, remote_address, size, true);
+	if (!remote_locked) {
+		DEBUG_TRACE(1, "Could not prefault remote range %p-%p", remote_address,
+				(void *) ((word_t) remote_address + size));
+	}
+	*wired = false;
+	if (wire && remote_locked) {
+		*wired = (mlock(local_address, size) == 0);
+		if (!*wired) {
+			DEBUG_TRACE(1, "Could not wire local range %p-%p", local_address,
+					(void *) ((word_t) local_address + size));
+		}
+	}
+	if (remote_locked && !*wired) {
+		remote_mlock(threadexec, remote_address, size, false);
+	}
+	return remote_locked;
+}
+
+void
+threadexec_shared_memory_usage(threadexec_t threadexec,
+		struct threadexec_shared_memory_usage *usage) {
+	usage->shmem_size      = threadexec->shmem_size;
+	usage->prefaulted_size = threadexec->shmem_prefaulted_size;
+	usage->wired_size      = threadexec->shmem_wired_size;
+	tx_shared_vm_pool_usage(threadexec, &usage->pool_size, &usage->pool_idle_size);
+}
+
+bool
+tx_shared_vm_translate(threadexec_t threadexec, const void *local_address, size_t size,
+		word_t *remote_address) {
+	const uint8_t *local = local_address;
+	// Check the default client region first, since it is the most common.
+	const uint8_t *client = threadexec->client_shmem;
+	if (client != NULL && local >= client
+			&& (size_t) (local - client) < threadexec->client_shmem_size
+			&& size <= threadexec->client_shmem_size - (local - client)) {
+		*remote_address = threadexec->client_shmem_remote + (local - client);
+		return true;
+	}
+	size_t index = find_mapping(threadexec, local);
+	if (index == threadexec->shared_mapping_count) {
+		return false;
+	}
+	const struct tx_shared_mapping *mapping = &threadexec->shared_mappings[index];
+	size_t offset = local - mapping->local;
+	if (offset >= mapping->size || size > mapping->size - offset) {
+		return false;
+	}
+	*remote_address = mapping->remote + offset;
+	return true;
+}
+
+bool
+threadexec_shared_vm_remote_address(threadexec_t threadexec, const void *local_address,
+		size_t size, const void **remote_address) {
+	word_t remote;
+	bool ok = tx_shared_vm_translate(threadexec, local_address, size, &remote);
+	if (ok) {
+		*remote_address = (const void *) remote;
+	}
+	return ok;
+}
+
+bool
+threadexec_shared_vm_local_address(threadexec_t threadexec, const void *remote_address,
+		size_t size, void **local_address) {
+	// The registry is sorted by local address, and there are few enough mappings that a linear
+	// search in the other direction is fine.
+	word_t remote = (word_t) remote_address;
+	word_t client = threadexec->client_shmem_remote;
+	if (threadexec->client_shmem != NULL && remote >= client
+			&& remote - client < threadexec->client_shmem_size
+			&& size <= threadexec->client_shmem_size - (remote - client)) {
+		*local_address = (uint8_t *) threadexec->client_shmem + (remote - client);
+		return true;
+	}
+	for (size_t i = 0; i < threadexec->shared_mapping_count; i++) {
+		const struct tx_shared_mapping *mapping = &threadexec->shared_mappings[i];
+		if (remote >= mapping->remote && remote - mapping->remote < mapping->size
+				&& size <= mapping->size - (remote - mapping->remote)) {
+			*local_address = mapping->local + (remote - mapping->remote);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+threadexec_shared_vm_translate_pointers(threadexec_t threadexec, void *data,
+		const size_t *pointer_offsets, size_t pointer_count) {
+	uint8_t *base = data;
+	// Translate everything before storing anything, so that a failure leaves the data as it
+	// was.
+	word_t *remote = malloc(pointer_count * sizeof(*remote) + 1);
+	assert(remote != NULL);
+	bool success = false;
+	for (size_t i = 0; i < pointer_count; i++) {
+		word_t local;
+		memcpy(&local, base + pointer_offsets[i], sizeof(local));
+		remote[i] = 0;
+		if (local == 0) {
+			continue;
+		}
+		bool ok = tx_shared_vm_translate(threadexec, (const void *) local, 0, &remote[i]);
+		if (!ok) {
+			ERROR("Pointer %p at offset %zu is not in shared memory", (void *) local,
+					pointer_offsets[i]);
+			goto fail;
+		}
+	}
+	for (size_t i = 0; i < pointer_count; i++) {
+		memcpy(base + pointer_offsets[i], &remote[i], sizeof(remote[i]));
+	}
+	success = true;
+fail:
+	free(remote);
+	return success;
+}
+
+// Test whether two ranges overlap.
+static bool
+ranges_overlap(word_t start_a, size_t size_a, word_t start_b, size_t size_b) {
+	return (start_a < start_b + size_b && start_b < start_a + size_a);
+}
+
+bool
+tx_shared_vm_owns(threadexec_t threadexec, word_t remote_address, size_t size) {
+	if (ranges_overlap(remote_address, size, threadexec->shmem_remote,
+				threadexec->shmem_size)) {
+		return true;
+	}
+	for (size_t i = 0; i < threadexec->shared_mapping_count; i++) {
+		const struct tx_shared_mapping *mapping = &threadexec->shared_mappings[i];
+		if (ranges_overlap(remote_address, size, mapping->remote, mapping->size)) {
+			return true;
+		}
+	}
+	return tx_shared_vm_pool_overlaps(threadexec, remote_address, size);
+}
+
+void
+tx_shared_vm_deinit(threadexec_t threadexec) {
+	free(threadexec->shared_mappings);
+	threadexec->shared_mappings      = NULL;
+	threadexec->shared_mapping_count = 0;
+}
+
 bool
 threadexec_mach_vm_deallocate(threadexec_t threadexec,
 		const void *remote_address, size_t size) {
@@ -174,6 +433,7 @@ threadexec_mach_vm_deallocate(threadexec_t threadexec,
 void
 threadexec_shared_vm_deallocate(threadexec_t threadexec,
 		const void *remote_address, void *local_address, size_t size) {
+	unregister_mapping(threadexec, local_address);
 	threadexec_mach_vm_deallocate(threadexec, remote_address, size);
 	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t) local_address, size);
 }
@@ -0,0 +1,160 @@
+#include "tx_shared_vm_pool.h"
+
+#include "tx_internal.h"
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// Size classes are powers of 2 starting at TX_SHARED_VM_POOL_MIN_SIZE.
+#define CLASS_COUNT (sizeof(size_t) * 8 - __builtin_ctzl(TX_SHARED_VM_POOL_MIN_SIZE))
+
+// An idle shared memory region.
+struct pool_region {
+	struct pool_region *next;
+	const void *remote_address;
+	void *local_address;
+};
+
+struct tx_shared_vm_pool {
+	// The idle regions of each size class, most recently used first.
+	struct pool_region *idle[CLASS_COUNT];
+	// The total size of the idle regions.
+	size_t idle_size;
+	// The total size of all the regions, idle or in use.
+	size_t mapped_size;
+};
+
+// Get the size class for an allocation size.
+static unsigned
+size_class(size_t size) {
+	if (size <= TX_SHARED_VM_POOL_MIN_SIZE) {
+		return 0;
+	}
+	unsigned bits = sizeof(size_t) * 8 - __builtin_clzl(size - 1);
+	return bits - __builtin_ctzl(TX_SHARED_VM_POOL_MIN_SIZE);
+}
+
+static size_t
+class_size(unsigned class) {
+	return (size_t) TX_SHARED_VM_POOL_MIN_SIZE << class;
+}
+
+// Unmap idle regions, largest first, until at most the specified number of bytes are idle.
+static void
+trim(threadexec_t threadexec, struct tx_shared_vm_pool *pool, size_t limit) {
+	for (unsigned class = CLASS_COUNT; class > 0 && pool->idle_size > limit; class--) {
+		struct pool_region **idle = &pool->idle[class - 1];
+		size_t size = class_size(class - 1);
+		while (*idle != NULL && pool->idle_size > limit) {
+			struct pool_region *region = *idle;
+			*idle = region->next;
+			pool->idle_size   -= size;
+			pool->mapped_size -= size;
+			threadexec_shared_vm_deallocate(threadexec, region->remote_address,
+					region->local_address, size);
+			free(region);
+		}
+	}
+}
+
+bool
+tx_shared_vm_pool_allocate(threadexec_t threadexec, size_t size,
+		const void **remote_address, void **local_address) {
+	struct tx_shared_vm_pool *pool = threadexec->shared_vm_pool;
+	if (pool == NULL) {
+		pool = calloc(1, sizeof(*pool));
+		assert(pool != NULL);
+		threadexec->shared_vm_pool = pool;
+	}
+	unsigned class = size_class(size);
+	struct pool_region *region = pool->idle[class];
+	if (region != NULL) {
+		pool->idle[class] = region->next;
+		pool->idle_size -= class_size(class);
+		*remote_address = region->remote_address;
+		*local_address  = region->local_address;
+		free(region);
+		return true;
+	}
+	// Round up to the size class so that the mapping can be reused by any allocation in the
+	// class. Since the classes grow geometrically, at most half of the mapping is wasted.
+	size_t size_in_class = class_size(class);
+	DEBUG_TRACE(2, "Growing shared VM pool with a region of size %zu", size_in_class);
+	bool ok = tx_shared_vm_allocate(threadexec, remote_address, local_address,
+			size_in_class, 0);
+	if (!ok) {
+		return false;
+	}
+	pool->mapped_size += size_in_class;
+	// Fault the new region in on both sides now, so the call using it doesn't.
+	if (threadexec->shmem_options.prefault || threadexec->shmem_options.wire) {
+		bool wired;
+		tx_shared_vm_prefault(threadexec, *remote_address, *local_address, size_in_class,
+				false, &wired);
+	}
+	return true;
+}
+
+void
+tx_shared_vm_pool_free(threadexec_t threadexec, const void *remote_address,
+		void *local_address, size_t size) {
+	struct tx_shared_vm_pool *pool = threadexec->shared_vm_pool;
+	assert(pool != NULL);
+	unsigned class = size_class(size);
+	struct pool_region *region = malloc(sizeof(*region));
+	assert(region != NULL);
+	region->next           = pool->idle[class];
+	region->remote_address = remote_address;
+	region->local_address  = local_address;
+	pool->idle[class] = region;
+	pool->idle_size += class_size(class);
+	// Keep the pool from holding on to too much memory after a burst of large calls.
+	trim(threadexec, pool, TX_SHARED_VM_POOL_IDLE_LIMIT);
+}
+
+void
+tx_shared_vm_pool_deinit(threadexec_t threadexec) {
+	struct tx_shared_vm_pool *pool = threadexec->shared_vm_pool;
+	if (pool == NULL) {
+		return;
+	}
+	trim(threadexec, pool, 0);
+	free(pool);
+	threadexec->shared_vm_pool = NULL;
+}
+
+void
+tx_shared_vm_pool_usage(threadexec_t threadexec, size_t *size, size_t *idle_size) {
+	struct tx_shared_vm_pool *pool = threadexec->shared_vm_pool;
+	*size      = (pool != NULL ? pool->mapped_size : 0);
+	*idle_size = (pool != NULL ? pool->idle_size : 0);
+}
+
+bool
+tx_shared_vm_pool_overlaps(threadexec_t threadexec, word_t remote_address, size_t size) {
+	struct tx_shared_vm_pool *pool = threadexec->shared_vm_pool;
+	if (pool == NULL) {
+		return false;
+	}
+	for (unsigned class = 0; class < CLASS_COUNT; class++) {
+		for (struct pool_region *region = pool->idle[class]; region != NULL;
+				region = region->next) {
+			word_t start = (word_t) region->remote_address;
+			if (start < remote_address + size && remote_address < start + class_size(class)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void
+threadexec_shared_vm_pool_trim(threadexec_t threadexec, size_t idle_limit) {
+	struct tx_shared_vm_pool *pool = threadexec->shared_vm_pool;
+	if (pool != NULL) {
+		trim(threadexec, pool, idle_limit);
+	}
+}
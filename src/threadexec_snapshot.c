@@ -0,0 +1,284 @@
+#include "tx_internal.h"
+
+#include "tx_log.h"
+#include "tx_prototypes.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// The state of a range while it is being snapshotted.
+struct snapshot {
+	mach_vm_address_t start;
+	mach_vm_size_t size;
+	mach_vm_offset_t offset;
+	mach_port_t memory_entry_remote;
+	mach_vm_address_t local;
+};
+
+// Call thread_suspend() or thread_resume() on a thread in the remote task, by its remote name.
+static kern_return_t
+remote_thread_control(threadexec_t threadexec, mach_port_name_t thread, bool suspend) {
+	kern_return_t kr;
+	bool ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+			(suspend ? (void *) thread_suspend : (void *) thread_resume), 1,
+			TX_CARG_LITERAL(thread_act_t, thread));
+	if (!ok) {
+		ERROR("Could not call %s in remote thread",
+				(suspend ? "thread_suspend" : "thread_resume"));
+		return KERN_FAILURE;
+	}
+	return kr;
+}
+
+// Suspend all the threads in the task except the threadexec thread. This is only used with the
+// thread API, where we have no usable task port, so the threads are enumerated and suspended by
+// the remote thread itself. Returns the remote names of the threads that were suspended, which
+// must be passed to resume_other_threads().
+static mach_port_name_t *
+suspend_other_threads(threadexec_t threadexec, mach_msg_type_number_t *count) {
+	word_t threads_remote;
+	kern_return_t kr;
+	bool ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+			task_threads, 3,
+			TX_CARG_LITERAL(task_t, threadexec->task_remote),
+			TX_CARG_PTR_LITERAL_OUT(word_t *, &threads_remote),
+			TX_CARG_PTR_LITERAL_OUT(mach_msg_type_number_t *, count));
+	if (!ok) {
+		ERROR_REMOTE_CALL(task_threads);
+		return NULL;
+	}
+	if (kr != KERN_SUCCESS) {
+		ERROR_REMOTE_CALL_FAIL(task_threads, "%u", kr);
+		return NULL;
+	}
+	size_t array_size = *count * sizeof(mach_port_name_t);
+	mach_port_name_t *threads = malloc(array_size + 1);
+	assert(threads != NULL);
+	ok = threadexec_read(threadexec, (const void *) threads_remote, threads, array_size);
+	threadexec_mach_vm_deallocate(threadexec, (const void *) threads_remote, array_size);
+	if (!ok) {
+		ERROR("Could not read remote thread list");
+		free(threads);
+		return NULL;
+	}
+	for (size_t i = 0; i < *count; i++) {
+		if (threads[i] == threadexec->thread_remote) {
+			threadexec_mach_port_deallocate(threadexec, threads[i]);
+			threads[i] = MACH_PORT_NULL;
+			continue;
+		}
+		kr = remote_thread_control(threadexec, threads[i], true);
+		if (kr != KERN_SUCCESS) {
+			DEBUG_TRACE(1, "Could not suspend thread 0x%x: %u", threads[i], kr);
+			threadexec_mach_port_deallocate(threadexec, threads[i]);
+			threads[i] = MACH_PORT_NULL;
+		}
+	}
+	return threads;
+}
+
+static void
+resume_other_threads(threadexec_t threadexec, mach_port_name_t *threads,
+		mach_msg_type_number_t count) {
+	for (size_t i = 0; i < count; i++) {
+		if (threads[i] != MACH_PORT_NULL) {
+			remote_thread_control(threadexec, threads[i], false);
+			threadexec_mach_port_deallocate(threadexec, threads[i]);
+		}
+	}
+	free(threads);
+}
+
+// Snapshot a range directly into the local task using the task API.
+static bool
+snapshot_with_task_api(threadexec_t threadexec, struct snapshot *snapshot) {
+	assert(tx_supports_task_api(threadexec));
+	vm_prot_t cur_protection, max_protection;
+	kern_return_t kr = mach_vm_remap(mach_task_self(),
+			&snapshot->local,
+			snapshot->size,
+			0,
+			VM_FLAGS_ANYWHERE,
+			threadexec->task,
+			snapshot->start,
+			TRUE,
+			&cur_protection,
+			&max_protection,
+			VM_INHERIT_NONE);
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "mach_vm_remap: %u", kr);
+		return false;
+	}
+	// The copy keeps the target's protection, so make it read-only like the thread API
+	// snapshots.
+	kr = mach_vm_protect(mach_task_self(), snapshot->local, snapshot->size, FALSE,
+			VM_PROT_READ);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_vm_protect, "%u", kr);
+		mach_vm_deallocate(mach_task_self(), snapshot->local, snapshot->size);
+		snapshot->local = 0;
+		return false;
+	}
+	return true;
+}
+
+// Create a copy-on-write memory entry for the range in the remote task. This is the only part of
+// the thread API snapshot that needs the target paused.
+static bool
+snapshot_entry_with_thread_api(threadexec_t threadexec, struct snapshot *snapshot) {
+	memory_object_size_t entry_size = snapshot->size;
+	kern_return_t kr;
+	bool ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+			mach_make_memory_entry_64, 6,
+			TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+			TX_CARG_PTR_LITERAL_INOUT(memory_object_size_t *, &entry_size),
+			TX_CARG_LITERAL(memory_object_offset_t, snapshot->start),
+			TX_CARG_LITERAL(vm_prot_t, VM_PROT_READ | MAP_MEM_VM_COPY),
+			TX_CARG_PTR_LITERAL_OUT(mach_port_t *, &snapshot->memory_entry_remote),
+			TX_CARG_LITERAL(mem_entry_name_port_t, MACH_PORT_NULL));
+	if (!ok) {
+		ERROR_REMOTE_CALL(mach_make_memory_entry_64);
+		return false;
+	}
+	if (kr != KERN_SUCCESS) {
+		ERROR_REMOTE_CALL_FAIL(mach_make_memory_entry_64, "%u", kr);
+		return false;
+	}
+	if (entry_size < snapshot->size) {
+		ERROR("Snapshot memory entry is too small: %llu < %llu",
+				entry_size, snapshot->size);
+		threadexec_mach_port_deallocate(threadexec, snapshot->memory_entry_remote);
+		snapshot->memory_entry_remote = MACH_PORT_NULL;
+		return false;
+	}
+	return true;
+}
+
+// Bring the remote memory entry into the local task and map it. The remote entry is consumed.
+static bool
+snapshot_map_with_thread_api(threadexec_t threadexec, struct snapshot *snapshot) {
+	mach_port_t memory_entry;
+	bool ok = threadexec_mach_port_extract(threadexec, snapshot->memory_entry_remote,
+			&memory_entry, MACH_MSG_TYPE_MOVE_SEND);
+	if (!ok) {
+		ERROR("Could not extract snapshot memory entry");
+		threadexec_mach_port_deallocate(threadexec, snapshot->memory_entry_remote);
+		snapshot->memory_entry_remote = MACH_PORT_NULL;
+		return false;
+	}
+	snapshot->memory_entry_remote = MACH_PORT_NULL;
+	kern_return_t kr = mach_vm_map(mach_task_self(),
+			&snapshot->local,
+			snapshot->size,
+			0,
+			VM_FLAGS_ANYWHERE,
+			memory_entry,
+			0,
+			FALSE,
+			VM_PROT_READ,
+			VM_PROT_READ,
+			VM_INHERIT_NONE);
+	mach_port_deallocate(mach_task_self(), memory_entry);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_vm_map, "%u", kr);
+		snapshot->local = 0;
+		return false;
+	}
+	return true;
+}
+
+bool
+threadexec_snapshot_region(threadexec_t threadexec,
+		struct threadexec_snapshot_range *ranges, size_t count, bool pause) {
+	bool success = false;
+	// The snapshot must include any writes we have buffered.
+	bool ok = threadexec_write_buffer_flush(threadexec);
+	if (!ok) {
+		return false;
+	}
+	struct snapshot *snapshots = calloc(count, sizeof(*snapshots));
+	assert(snapshots != NULL);
+	for (size_t i = 0; i < count; i++) {
+		mach_vm_address_t address = (mach_vm_address_t) ranges[i].remote_address;
+		snapshots[i].start  = mach_vm_trunc_page(address);
+		snapshots[i].offset = address - snapshots[i].start;
+		snapshots[i].size   = mach_vm_round_page(address + ranges[i].size)
+			- snapshots[i].start;
+	}
+	bool use_task_api = tx_supports_task_api(threadexec);
+	// Pause the target only for the part of the snapshot that has to be atomic. With the task
+	// API we can suspend the whole task since we don't need the remote thread.
+	mach_port_name_t *threads = NULL;
+	mach_msg_type_number_t thread_count = 0;
+	if (pause) {
+		if (use_task_api) {
+			kern_return_t kr = task_suspend(threadexec->task);
+			if (kr != KERN_SUCCESS) {
+				ERROR_CALL(task_suspend, "%u", kr);
+				goto fail_0;
+			}
+		} else {
+			threads = suspend_other_threads(threadexec, &thread_count);
+			if (threads == NULL) {
+				goto fail_0;
+			}
+		}
+	}
+	for (size_t i = 0; ok && i < count; i++) {
+		if (use_task_api) {
+			ok = snapshot_with_task_api(threadexec, &snapshots[i]);
+		} else {
+			ok = snapshot_entry_with_thread_api(threadexec, &snapshots[i]);
+		}
+	}
+	if (pause) {
+		if (use_task_api) {
+			task_resume(threadexec->task);
+		} else {
+			resume_other_threads(threadexec, threads, thread_count);
+		}
+	}
+	// Now that the target is running again, map the thread API snapshots locally.
+	for (size_t i = 0; ok && !use_task_api && i < count; i++) {
+		ok = snapshot_map_with_thread_api(threadexec, &snapshots[i]);
+	}
+	if (!ok) {
+		goto fail_1;
+	}
+	// Success!
+	for (size_t i = 0; i < count; i++) {
+		ranges[i].local_address = (const void *)
+			(snapshots[i].local + snapshots[i].offset);
+	}
+	success = true;
+fail_1:
+	if (!success) {
+		for (size_t i = 0; i < count; i++) {
+			if (snapshots[i].memory_entry_remote != MACH_PORT_NULL) {
+				threadexec_mach_port_deallocate(threadexec,
+						snapshots[i].memory_entry_remote);
+			}
+			if (snapshots[i].local != 0) {
+				mach_vm_deallocate(mach_task_self(), snapshots[i].local,
+						snapshots[i].size);
+			}
+		}
+	}
+fail_0:
+	free(snapshots);
+	return success;
+}
+
+void
+threadexec_snapshot_release(const struct threadexec_snapshot_range *ranges, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		if (ranges[i].local_address == NULL) {
+			continue;
+		}
+		mach_vm_address_t local = (mach_vm_address_t) ranges[i].local_address;
+		mach_vm_address_t start = mach_vm_trunc_page(local);
+		mach_vm_size_t size = mach_vm_round_page(local + ranges[i].size) - start;
+		mach_vm_deallocate(mach_task_self(), start, size);
+	}
+}
@@ -0,0 +1,142 @@
+#include "tx_stack_profile.h"
+
+#include "tx_internal.h"
+#include "tx_log.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The value the unused part of the stack is painted with.
+#define STACK_PAINT ((word_t) 0x5a5a5a5a5a5a5a5a)
+
+struct tx_stack_profile {
+	// The usage records, sorted by function.
+	struct threadexec_stack_usage *usage;
+	size_t count;
+	size_t capacity;
+	// The function of the call in progress, or 0.
+	word_t function;
+};
+
+// The lowest local address of the stack.
+static word_t *
+stack_limit(threadexec_t threadexec) {
+	return (word_t *) ((uint8_t *) threadexec->stack_base - threadexec->stack_size);
+}
+
+static void
+paint(word_t *start, word_t *end) {
+	for (word_t *p = start; p < end; p++) {
+		*p = STACK_PAINT;
+	}
+}
+
+// Find the usage record for a function, inserting a new one if needed.
+static struct threadexec_stack_usage *
+find_usage(struct tx_stack_profile *profile, word_t function) {
+	size_t lo = 0, hi = profile->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ((word_t) profile->usage[mid].function < function) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < profile->count && (word_t) profile->usage[lo].function == function) {
+		return &profile->usage[lo];
+	}
+	if (profile->count == profile->capacity) {
+		profile->capacity = max(2 * profile->capacity, (size_t) 32);
+		profile->usage = realloc(profile->usage,
+				profile->capacity * sizeof(*profile->usage));
+		assert(profile->usage != NULL);
+	}
+	memmove(&profile->usage[lo + 1], &profile->usage[lo],
+			(profile->count - lo) * sizeof(*profile->usage));
+	profile->count++;
+	struct threadexec_stack_usage *usage = &profile->usage[lo];
+	usage->function  = (const void *) function;
+	usage->max_depth = 0;
+	usage->calls     = 0;
+	return usage;
+}
+
+void
+tx_stack_profile_start(threadexec_t threadexec, word_t function) {
+	struct tx_stack_profile *profile = threadexec->stack_profile;
+	if (profile != NULL) {
+		profile->function = function;
+	}
+}
+
+void
+tx_stack_profile_finish(threadexec_t threadexec) {
+	struct tx_stack_profile *profile = threadexec->stack_profile;
+	if (profile == NULL || profile->function == 0) {
+		return;
+	}
+	// The stack grows down, so the deepest point the call reached is just above the last word
+	// of paint, counting up from the limit.
+	word_t *limit = stack_limit(threadexec);
+	word_t *top   = (word_t *) threadexec->stack_base;
+	word_t *lowest = limit;
+	while (lowest < top && *lowest == STACK_PAINT) {
+		lowest++;
+	}
+	size_t depth = (uint8_t *) top - (uint8_t *) lowest;
+	if (lowest == limit) {
+		WARNING("Remote call to %p used the whole stack of %zu bytes",
+				(void *) profile->function, threadexec->stack_size);
+	}
+	struct threadexec_stack_usage *usage = find_usage(profile, profile->function);
+	usage->max_depth = max(usage->max_depth, depth);
+	usage->calls++;
+	profile->function = 0;
+	// Only the part of the stack that was used needs repainting.
+	paint(lowest, top);
+}
+
+void
+tx_stack_profile_deinit(threadexec_t threadexec) {
+	struct tx_stack_profile *profile = threadexec->stack_profile;
+	if (profile != NULL) {
+		free(profile->usage);
+		free(profile);
+		threadexec->stack_profile = NULL;
+	}
+}
+
+bool
+threadexec_stack_profile_enable(threadexec_t threadexec) {
+	tx_stack_profile_deinit(threadexec);
+	struct tx_stack_profile *profile = calloc(1, sizeof(*profile));
+	if (profile == NULL) {
+		return false;
+	}
+	paint(stack_limit(threadexec), (word_t *) threadexec->stack_base);
+	threadexec->stack_profile = profile;
+	return true;
+}
+
+void
+threadexec_stack_profile_disable(threadexec_t threadexec) {
+	tx_stack_profile_deinit(threadexec);
+}
+
+void
+threadexec_stack_usage(threadexec_t threadexec,
+		const struct threadexec_stack_usage **usage, size_t *count, size_t *stack_size) {
+	struct tx_stack_profile *profile = threadexec->stack_profile;
+	if (usage != NULL) {
+		*usage = (profile != NULL ? profile->usage : NULL);
+	}
+	if (count != NULL) {
+		*count = (profile != NULL ? profile->count : 0);
+	}
+	if (stack_size != NULL) {
+		*stack_size = threadexec->stack_size;
+	}
+}
@@ -0,0 +1,275 @@
+#include "tx_vm_map.h"
+
+#include "tx_internal.h"
+#include "tx_log.h"
+#include "tx_prototypes.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// A sorted array of the regions mapped in the remote task.
+struct tx_vm_map {
+	struct threadexec_vm_region *regions;
+	size_t count;
+	size_t capacity;
+};
+
+static void
+region_list_append(struct tx_vm_map *list, const struct threadexec_vm_region *region) {
+	if (list->count == list->capacity) {
+		list->capacity = max(2 * list->capacity, (size_t) 64);
+		list->regions = realloc(list->regions, list->capacity * sizeof(*list->regions));
+		assert(list->regions != NULL);
+	}
+	list->regions[list->count++] = *region;
+}
+
+static word_t
+region_end(const struct threadexec_vm_region *region) {
+	return (word_t) region->address + region->size;
+}
+
+// Find the index of the first region that ends after the specified address.
+static size_t
+region_find(const struct tx_vm_map *map, word_t address) {
+	size_t lo = 0, hi = map->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (region_end(&map->regions[mid]) <= address) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Call mach_vm_region_recurse() on the remote task, using the task API if possible.
+static kern_return_t
+region_recurse(threadexec_t threadexec, mach_vm_address_t *address, mach_vm_size_t *size,
+		natural_t *depth, vm_region_submap_info_data_64_t *info) {
+	mach_msg_type_number_t count = VM_REGION_SUBMAP_INFO_COUNT_64;
+	if (tx_supports_task_api(threadexec)) {
+		return mach_vm_region_recurse(threadexec->task, address, size, depth,
+				(vm_region_recurse_info_t) info, &count);
+	}
+	kern_return_t kr;
+	bool ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+			mach_vm_region_recurse, 6,
+			TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+			TX_CARG_PTR_LITERAL_INOUT(mach_vm_address_t *, address),
+			TX_CARG_PTR_LITERAL_OUT(mach_vm_size_t *, size),
+			TX_CARG_PTR_LITERAL_INOUT(natural_t *, depth),
+			TX_CARG_PTR_DATA_OUT(vm_region_recurse_info_t, info, sizeof(*info)),
+			TX_CARG_PTR_LITERAL_INOUT(mach_msg_type_number_t *, &count));
+	if (!ok) {
+		ERROR_REMOTE_CALL(mach_vm_region_recurse);
+		return KERN_FAILURE;
+	}
+	return kr;
+}
+
+// Enumerate the regions overlapping [start, end) into the list, descending into submaps.
+static bool
+enumerate_regions(threadexec_t threadexec, word_t start, word_t end, struct tx_vm_map *list) {
+	mach_vm_address_t address = start;
+	natural_t depth = 0;
+	for (;;) {
+		mach_vm_size_t size = 0;
+		vm_region_submap_info_data_64_t info;
+		kern_return_t kr = region_recurse(threadexec, &address, &size, &depth, &info);
+		if (kr == KERN_INVALID_ADDRESS) {
+			// There are no more regions.
+			break;
+		}
+		if (kr != KERN_SUCCESS) {
+			ERROR_CALL(mach_vm_region_recurse, "%u", kr);
+			return false;
+		}
+		if (address >= end) {
+			break;
+		}
+		if (info.is_submap) {
+			depth++;
+			continue;
+		}
+		struct threadexec_vm_region region = {
+			.address        = (const void *) address,
+			.size           = size,
+			.protection     = info.protection,
+			.max_protection = info.max_protection,
+			.user_tag       = info.user_tag,
+		};
+		region_list_append(list, &region);
+		address += size;
+		if (address == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+// Replace the cached regions overlapping [start, end) with a fresh enumeration.
+static bool
+refresh_range(threadexec_t threadexec, struct tx_vm_map *map, word_t start, word_t end) {
+	struct tx_vm_map fresh = {};
+	bool ok = enumerate_regions(threadexec, start, end, &fresh);
+	if (!ok) {
+		free(fresh.regions);
+		return false;
+	}
+	// The fresh regions may extend past the range, so widen it to cover them.
+	if (fresh.count > 0) {
+		start = min(start, (word_t) fresh.regions[0].address);
+		end   = max(end, region_end(&fresh.regions[fresh.count - 1]));
+	}
+	// Splice the fresh regions in place of any old ones overlapping the range.
+	struct tx_vm_map merged = {};
+	size_t i = 0;
+	for (; i < map->count && region_end(&map->regions[i]) <= start; i++) {
+		region_list_append(&merged, &map->regions[i]);
+	}
+	for (size_t j = 0; j < fresh.count; j++) {
+		region_list_append(&merged, &fresh.regions[j]);
+	}
+	for (; i < map->count; i++) {
+		if ((word_t) map->regions[i].address >= end) {
+			region_list_append(&merged, &map->regions[i]);
+		}
+	}
+	free(fresh.regions);
+	free(map->regions);
+	*map = merged;
+	return true;
+}
+
+// Get the region map, building it if necessary.
+static struct tx_vm_map *
+get_vm_map(threadexec_t threadexec) {
+	struct tx_vm_map *map = threadexec->vm_map;
+	if (map != NULL) {
+		return map;
+	}
+	map = calloc(1, sizeof(*map));
+	assert(map != NULL);
+	bool ok = refresh_range(threadexec, map, 0, (word_t) -1);
+	if (!ok) {
+		ERROR("Could not enumerate remote memory regions");
+		free(map->regions);
+		free(map);
+		return NULL;
+	}
+	DEBUG_TRACE(2, "Found %zu remote memory regions", map->count);
+	threadexec->vm_map = map;
+	return map;
+}
+
+// Check whether [address, address + size) is covered by contiguous regions that all have the
+// specified protection.
+static bool
+range_has_protection(const struct tx_vm_map *map, word_t address, size_t size,
+		vm_prot_t protection) {
+	if (size == 0) {
+		return true;
+	}
+	word_t end = address + size;
+	for (size_t i = region_find(map, address); i < map->count; i++) {
+		const struct threadexec_vm_region *region = &map->regions[i];
+		if ((word_t) region->address > address) {
+			return false;
+		}
+		if ((region->protection & protection) != protection) {
+			return false;
+		}
+		address = region_end(region);
+		if (address >= end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+tx_vm_map_check(threadexec_t threadexec, word_t remote_address, size_t size,
+		vm_prot_t protection, bool refresh) {
+	struct tx_vm_map *map = threadexec->vm_map;
+	if (map == NULL) {
+		return true;
+	}
+	if (range_has_protection(map, remote_address, size, protection)) {
+		return true;
+	}
+	if (!refresh) {
+		return false;
+	}
+	// The map may just be out of date.
+	DEBUG_TRACE(2, "Refreshing region map for %p-%p", (void *) remote_address,
+			(void *) (remote_address + size));
+	bool ok = refresh_range(threadexec, map, remote_address, remote_address + size);
+	if (!ok) {
+		return false;
+	}
+	return range_has_protection(map, remote_address, size, protection);
+}
+
+void
+tx_vm_map_deinit(threadexec_t threadexec) {
+	struct tx_vm_map *map = threadexec->vm_map;
+	if (map == NULL) {
+		return;
+	}
+	free(map->regions);
+	free(map);
+	threadexec->vm_map = NULL;
+}
+
+bool
+threadexec_vm_regions(threadexec_t threadexec, bool refresh,
+		const struct threadexec_vm_region **regions, size_t *count) {
+	if (refresh) {
+		tx_vm_map_deinit(threadexec);
+	}
+	struct tx_vm_map *map = get_vm_map(threadexec);
+	if (map == NULL) {
+		return false;
+	}
+	*regions = map->regions;
+	*count   = map->count;
+	return true;
+}
+
+bool
+threadexec_vm_regions_refresh(threadexec_t threadexec, const void *remote_address, size_t size) {
+	struct tx_vm_map *map = threadexec->vm_map;
+	if (map == NULL) {
+		return (get_vm_map(threadexec) != NULL);
+	}
+	bool ok = refresh_range(threadexec, map, (word_t) remote_address,
+			(word_t) remote_address + size);
+	if (!ok) {
+		ERROR("Could not enumerate remote memory regions");
+	}
+	return ok;
+}
+
+bool
+threadexec_vm_region_lookup(threadexec_t threadexec, const void *remote_address,
+		struct threadexec_vm_region *region) {
+	struct tx_vm_map *map = get_vm_map(threadexec);
+	if (map == NULL) {
+		return false;
+	}
+	size_t index = region_find(map, (word_t) remote_address);
+	if (index == map->count
+			|| (word_t) map->regions[index].address > (word_t) remote_address) {
+		return false;
+	}
+	*region = map->regions[index];
+	return true;
+}
+
+void
+threadexec_vm_regions_discard(threadexec_t threadexec) {
+	tx_vm_map_deinit(threadexec);
+}
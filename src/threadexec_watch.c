@@ -0,0 +1,327 @@
+#include "tx_internal.h"
+
+#include "thread_debug.h"
+#include "tx_log.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// The message ID of mach_exception_raise().
+#define MACH_EXCEPTION_RAISE_ID 2405
+
+#pragma pack(push, 4)
+
+// The request message for mach_exception_raise() with EXCEPTION_DEFAULT | MACH_EXCEPTION_CODES.
+struct exception_raise_request {
+	mach_msg_header_t          hdr;
+	mach_msg_body_t            body;
+	mach_msg_port_descriptor_t thread;
+	mach_msg_port_descriptor_t task;
+	NDR_record_t               NDR;
+	exception_type_t           exception;
+	mach_msg_type_number_t     code_count;
+	int64_t                    code[2];
+	mach_msg_trailer_t         trailer;
+};
+
+struct exception_raise_reply {
+	mach_msg_header_t          hdr;
+	NDR_record_t               NDR;
+	kern_return_t              ret_code;
+};
+
+#pragma pack(pop)
+
+struct threadexec_watch {
+	threadexec_t threadexec;
+	// The port on which we receive exceptions.
+	mach_port_t port;
+	// The watchpoints.
+	struct thread_watchpoint watchpoints[8];
+	unsigned count;
+	// The exception handlers that were installed before ours.
+	mach_msg_type_number_t saved_count;
+	exception_mask_t saved_masks[EXC_TYPES_COUNT];
+	mach_port_t saved_ports[EXC_TYPES_COUNT];
+	exception_behavior_t saved_behaviors[EXC_TYPES_COUNT];
+	thread_state_flavor_t saved_flavors[EXC_TYPES_COUNT];
+	// The threads currently single-stepping over a watched access. We hold a reference on
+	// each.
+	thread_act_t *stepping;
+	size_t stepping_count;
+	size_t stepping_capacity;
+};
+
+static void
+stepping_add(threadexec_watch_t watch, thread_act_t thread) {
+	if (watch->stepping_count == watch->stepping_capacity) {
+		watch->stepping_capacity = (watch->stepping_capacity == 0 ? 4
+				: 2 * watch->stepping_capacity);
+		watch->stepping = realloc(watch->stepping,
+				watch->stepping_capacity * sizeof(*watch->stepping));
+		assert(watch->stepping != NULL);
+	}
+	mach_port_mod_refs(mach_task_self(), thread, MACH_PORT_RIGHT_SEND, 1);
+	watch->stepping[watch->stepping_count++] = thread;
+}
+
+static bool
+stepping_remove(threadexec_watch_t watch, thread_act_t thread) {
+	for (size_t i = 0; i < watch->stepping_count; i++) {
+		if (watch->stepping[i] == thread) {
+			watch->stepping[i] = watch->stepping[--watch->stepping_count];
+			mach_port_deallocate(mach_task_self(), thread);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Program the watchpoints (or clear them, if count is 0) on every thread in the task other than
+// the threadexec thread. Returns the number of threads programmed.
+static size_t
+program_threads(threadexec_watch_t watch, unsigned count) {
+	threadexec_t threadexec = watch->threadexec;
+	thread_act_array_t threads;
+	mach_msg_type_number_t thread_count;
+	kern_return_t kr = task_threads(threadexec->task, &threads, &thread_count);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(task_threads, "%u", kr);
+		return 0;
+	}
+	size_t programmed = 0;
+	for (size_t i = 0; i < thread_count; i++) {
+		// Our own thread must never take a watchpoint exception, since nobody would be
+		// listening while it runs a function call for us.
+		if (threads[i] != threadexec->thread) {
+			bool ok = thread_set_watchpoints(threads[i], watch->watchpoints, count);
+			programmed += ok;
+		}
+		mach_port_deallocate(mach_task_self(), threads[i]);
+	}
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t) threads,
+			thread_count * sizeof(*threads));
+	return programmed;
+}
+
+static void
+send_exception_reply(const struct exception_raise_request *request, kern_return_t ret_code) {
+	struct exception_raise_reply reply = {};
+	reply.hdr.msgh_bits        = MACH_MSGH_BITS(MACH_MSGH_BITS_REMOTE(request->hdr.msgh_bits), 0);
+	reply.hdr.msgh_size        = sizeof(reply);
+	reply.hdr.msgh_remote_port = request->hdr.msgh_remote_port;
+	reply.hdr.msgh_id          = request->hdr.msgh_id + 100;
+	reply.NDR                  = NDR_record;
+	reply.ret_code             = ret_code;
+	kern_return_t kr = mach_msg(&reply.hdr,
+			MACH_SEND_MSG,
+			reply.hdr.msgh_size,
+			0,
+			MACH_PORT_NULL,
+			MACH_MSG_TIMEOUT_NONE,
+			MACH_PORT_NULL);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_msg, "%u", kr);
+	}
+}
+
+// Find the watchpoint that an accessed address falls in. Returns false if there is none.
+static bool
+find_watchpoint(threadexec_watch_t watch, word_t address, unsigned *index) {
+	for (unsigned i = 0; i < watch->count; i++) {
+		const struct thread_watchpoint *wp = &watch->watchpoints[i];
+		// The reported address may be the start of a wider access that overlaps the
+		// watched bytes, so match on the containing doubleword.
+		if (address < wp->address + wp->size && wp->address < (address & ~7) + 8) {
+			*index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+threadexec_watch(threadexec_t threadexec, const struct threadexec_watchpoint *watchpoints,
+		size_t count, threadexec_watch_t *watch) {
+	if (!tx_supports_task_api(threadexec)) {
+		ERROR("Watchpoints require the task API");
+		return false;
+	}
+	unsigned max_count = thread_watchpoint_count();
+	if (count == 0 || count > max_count) {
+		ERROR("Cannot set %zu watchpoints: the limit is %u", count, max_count);
+		return false;
+	}
+	threadexec_watch_t w = calloc(1, sizeof(*w));
+	assert(w != NULL);
+	assert(max_count <= sizeof(w->watchpoints) / sizeof(w->watchpoints[0]));
+	w->threadexec = threadexec;
+	w->count      = (unsigned) count;
+	for (size_t i = 0; i < count; i++) {
+		word_t address = (word_t) watchpoints[i].remote_address;
+		size_t size    = watchpoints[i].size;
+		if ((size != 1 && size != 2 && size != 4 && size != 8) || address % size != 0) {
+			ERROR("Watchpoint %p size %zu is not naturally aligned",
+					(void *) address, size);
+			goto fail_0;
+		}
+		w->watchpoints[i].address = address;
+		w->watchpoints[i].size    = size;
+		w->watchpoints[i].read    = (watchpoints[i].access & TX_WATCH_READ) != 0;
+		w->watchpoints[i].write   = (watchpoints[i].access & TX_WATCH_WRITE) != 0;
+	}
+	// Create the exception port and install it on the task.
+	w->port = mach_port_allocate_receive_and_send();
+	if (w->port == MACH_PORT_NULL) {
+		ERROR("Could not allocate Mach port");
+		goto fail_0;
+	}
+	w->saved_count = EXC_TYPES_COUNT;
+	kern_return_t kr = task_swap_exception_ports(threadexec->task,
+			EXC_MASK_BREAKPOINT, w->port,
+			EXCEPTION_DEFAULT | MACH_EXCEPTION_CODES, THREAD_STATE_NONE,
+			w->saved_masks, &w->saved_count, w->saved_ports,
+			w->saved_behaviors, w->saved_flavors);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(task_swap_exception_ports, "%u", kr);
+		goto fail_1;
+	}
+	// Program the debug registers.
+	size_t programmed = program_threads(w, w->count);
+	if (programmed == 0) {
+		ERROR("Could not set watchpoints on any thread");
+		goto fail_2;
+	}
+	DEBUG_TRACE(1, "Set %u watchpoints on %zu threads", w->count, programmed);
+	*watch = w;
+	return true;
+fail_2:
+	for (size_t i = 0; i < w->saved_count; i++) {
+		task_set_exception_ports(threadexec->task, w->saved_masks[i], w->saved_ports[i],
+				w->saved_behaviors[i], w->saved_flavors[i]);
+		if (MACH_PORT_VALID(w->saved_ports[i])) {
+			mach_port_deallocate(mach_task_self(), w->saved_ports[i]);
+		}
+	}
+fail_1:
+	mach_port_destroy(mach_task_self(), w->port);
+fail_0:
+	free(w);
+	return false;
+}
+
+mach_port_t
+threadexec_watch_port(threadexec_watch_t watch) {
+	return watch->port;
+}
+
+bool
+threadexec_watch_wait(threadexec_watch_t watch, mach_msg_timeout_t timeout,
+		struct threadexec_watch_hit *hit) {
+	for (;;) {
+		struct exception_raise_request request;
+		mach_msg_option_t options = MACH_RCV_MSG;
+		if (timeout != MACH_MSG_TIMEOUT_NONE) {
+			options |= MACH_RCV_TIMEOUT;
+		}
+		kern_return_t kr = mach_msg(&request.hdr,
+				options,
+				0,
+				sizeof(request),
+				watch->port,
+				timeout,
+				MACH_PORT_NULL);
+		if (kr == MACH_RCV_TIMED_OUT) {
+			return false;
+		}
+		if (kr != KERN_SUCCESS) {
+			ERROR_CALL(mach_msg, "%u", kr);
+			return false;
+		}
+		if (request.hdr.msgh_id != MACH_EXCEPTION_RAISE_ID) {
+			ERROR("Received unexpected message ID %x on %s Mach port",
+					request.hdr.msgh_id, "exception");
+			mach_msg_destroy(&request.hdr);
+			continue;
+		}
+		thread_act_t thread = request.thread.name;
+		mach_port_deallocate(mach_task_self(), request.task.name);
+		kern_return_t ret_code = KERN_SUCCESS;
+		bool is_hit = false;
+		word_t address;
+		unsigned index;
+		if (stepping_remove(watch, thread)) {
+			// The thread has stepped over the watched access. Re-arm it.
+			thread_watchpoint_step_end(thread, watch->watchpoints, watch->count);
+		} else if (request.exception == EXC_BREAKPOINT
+				&& thread_watchpoint_decode(thread, request.code,
+					request.code_count, &address)
+				&& find_watchpoint(watch, address, &index)) {
+			is_hit = true;
+			hit->remote_address = (const void *) address;
+			hit->index          = index;
+			hit->thread         = thread;
+			hit->pc             = 0;
+			thread_get_pc(thread, &hit->pc);
+			if (thread_watchpoint_step_begin(thread)) {
+				stepping_add(watch, thread);
+			}
+		} else {
+			// Not ours. Failing the exception passes it on to the host handler.
+			ret_code = KERN_FAILURE;
+		}
+		send_exception_reply(&request, ret_code);
+		if (is_hit) {
+			return true;
+		}
+		mach_port_deallocate(mach_task_self(), thread);
+	}
+}
+
+void
+threadexec_watch_stop(threadexec_watch_t watch) {
+	threadexec_t threadexec = watch->threadexec;
+	// Put back the original exception handlers.
+	for (size_t i = 0; i < watch->saved_count; i++) {
+		task_set_exception_ports(threadexec->task, watch->saved_masks[i],
+				watch->saved_ports[i], watch->saved_behaviors[i],
+				watch->saved_flavors[i]);
+		if (MACH_PORT_VALID(watch->saved_ports[i])) {
+			mach_port_deallocate(mach_task_self(), watch->saved_ports[i]);
+		}
+	}
+	// Disarm every thread, including any still stepping.
+	program_threads(watch, 0);
+	for (size_t i = 0; i < watch->stepping_count; i++) {
+		thread_watchpoint_step_end(watch->stepping[i], NULL, 0);
+		mach_port_deallocate(mach_task_self(), watch->stepping[i]);
+	}
+	// Let any thread still blocked on one of our exceptions continue. With the watchpoints
+	// cleared, re-executing the access is harmless.
+	for (;;) {
+		struct exception_raise_request request;
+		kern_return_t kr = mach_msg(&request.hdr,
+				MACH_RCV_MSG | MACH_RCV_TIMEOUT,
+				0,
+				sizeof(request),
+				watch->port,
+				0,
+				MACH_PORT_NULL);
+		if (kr != KERN_SUCCESS) {
+			break;
+		}
+		if (request.hdr.msgh_id != MACH_EXCEPTION_RAISE_ID) {
+			mach_msg_destroy(&request.hdr);
+			continue;
+		}
+		thread_act_t thread = request.thread.name;
+		thread_watchpoint_step_end(thread, NULL, 0);
+		send_exception_reply(&request, KERN_SUCCESS);
+		mach_port_deallocate(mach_task_self(), thread);
+		mach_port_deallocate(mach_task_self(), request.task.name);
+	}
+	mach_port_destroy(mach_task_self(), watch->port);
+	free(watch->stepping);
+	free(watch);
+}
@@ -0,0 +1,305 @@
+#include "tx_write_buffer.h"
+
+#include "tx_internal.h"
+#include "tx_log.h"
+#include "tx_params.h"
+#include "tx_utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE_WB TX_WRITE_BUFFER_PAGE_SIZE
+
+// A page of remote memory with pending writes. The dirty bitmap records which bytes of data are
+// to be written; dirty_start and dirty_end bound the dirty bytes for quick overlap tests.
+struct tx_write_buffer_page {
+	word_t address;
+	size_t dirty_start;
+	size_t dirty_end;
+	uint8_t *data;
+	uint8_t dirty[PAGE_SIZE_WB / 8];
+};
+
+struct tx_write_buffer {
+	size_t page_capacity;
+	// The dirty pages, sorted by address.
+	size_t page_count;
+	struct tx_write_buffer_page **pages;
+	// The unused pages.
+	size_t free_count;
+	struct tx_write_buffer_page **free_pages;
+	struct tx_write_buffer_page *page_storage;
+	uint8_t *data_storage;
+	// Set while a flush is in progress, so that the remote calls made by the flush don't
+	// trigger another flush.
+	bool flushing;
+	// Set when a flush fails, so that the next threadexec_write_buffer_flush reports the lost
+	// writes even if the failed flush was an implicit one.
+	bool failed;
+};
+
+// Find the index of the first dirty page at or above the specified page address.
+static size_t
+find_page(struct tx_write_buffer *buffer, word_t address) {
+	size_t lo = 0, hi = buffer->page_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (buffer->pages[mid]->address < address) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Test whether any pending write overlaps the specified range.
+static bool
+overlaps_pending(struct tx_write_buffer *buffer, word_t address, size_t size) {
+	word_t end = address + size;
+	size_t index = find_page(buffer, address - address % PAGE_SIZE_WB);
+	for (; index < buffer->page_count; index++) {
+		struct tx_write_buffer_page *page = buffer->pages[index];
+		if (page->address >= end) {
+			break;
+		}
+		if (page->address + page->dirty_start < end
+				&& address < page->address + page->dirty_end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+mark_dirty(struct tx_write_buffer_page *page, size_t start, size_t end) {
+	for (size_t i = start; i < end; i++) {
+		page->dirty[i / 8] |= 1 << (i % 8);
+	}
+	if (page->dirty_start == page->dirty_end) {
+		page->dirty_start = start;
+		page->dirty_end   = end;
+	} else {
+		page->dirty_start = min(page->dirty_start, start);
+		page->dirty_end   = max(page->dirty_end, end);
+	}
+}
+
+static bool
+is_dirty(struct tx_write_buffer_page *page, size_t offset) {
+	return (page->dirty[offset / 8] & (1 << (offset % 8))) != 0;
+}
+
+// Count the number of pages that a write to the range would need to add to the buffer.
+static size_t
+new_pages_needed(struct tx_write_buffer *buffer, word_t address, size_t size) {
+	size_t needed = 0;
+	word_t first = address - address % PAGE_SIZE_WB;
+	size_t index = find_page(buffer, first);
+	for (word_t page = first; page < address + size; page += PAGE_SIZE_WB) {
+		if (index < buffer->page_count && buffer->pages[index]->address == page) {
+			index++;
+		} else {
+			needed++;
+		}
+	}
+	return needed;
+}
+
+// Get the dirty page for the specified page address, adding it if necessary.
+static struct tx_write_buffer_page *
+get_page(struct tx_write_buffer *buffer, word_t address) {
+	size_t index = find_page(buffer, address);
+	if (index < buffer->page_count && buffer->pages[index]->address == address) {
+		return buffer->pages[index];
+	}
+	assert(buffer->free_count > 0);
+	struct tx_write_buffer_page *page = buffer->free_pages[--buffer->free_count];
+	page->address     = address;
+	page->dirty_start = 0;
+	page->dirty_end   = 0;
+	memset(page->dirty, 0, sizeof(page->dirty));
+	memmove(&buffer->pages[index + 1], &buffer->pages[index],
+			(buffer->page_count - index) * sizeof(*buffer->pages));
+	buffer->pages[index] = page;
+	buffer->page_count++;
+	return page;
+}
+
+// Write all pending data with a single scatter-gather transfer. The buffer is emptied even if
+// some of the writes fail, since there is no way to retry them meaningfully.
+static bool
+flush(threadexec_t threadexec, struct tx_write_buffer *buffer) {
+	if (buffer->page_count == 0 || buffer->flushing) {
+		return true;
+	}
+	// Collect the runs of dirty bytes. Each page can contribute at most one run for every two
+	// bytes in its dirty range.
+	size_t capacity = 0;
+	for (size_t i = 0; i < buffer->page_count; i++) {
+		struct tx_write_buffer_page *page = buffer->pages[i];
+		capacity += (page->dirty_end - page->dirty_start + 1) / 2;
+	}
+	struct threadexec_iovec *iov = malloc(capacity * sizeof(*iov));
+	assert(iov != NULL);
+	size_t count = 0;
+	for (size_t i = 0; i < buffer->page_count; i++) {
+		struct tx_write_buffer_page *page = buffer->pages[i];
+		size_t offset = page->dirty_start;
+		while (offset < page->dirty_end) {
+			if (!is_dirty(page, offset)) {
+				offset++;
+				continue;
+			}
+			size_t start = offset;
+			while (offset < page->dirty_end && is_dirty(page, offset)) {
+				offset++;
+			}
+			assert(count < capacity);
+			iov[count].remote_address = (void *) (page->address + start);
+			iov[count].data           = page->data + start;
+			iov[count].size           = offset - start;
+			count++;
+		}
+	}
+	DEBUG_TRACE(2, "Flushing %zu pending writes in %zu pages", count, buffer->page_count);
+	buffer->flushing = true;
+	bool ok = threadexec_writev(threadexec, iov, count);
+	buffer->flushing = false;
+	if (!ok) {
+		ERROR("Could not flush pending writes");
+		buffer->failed = true;
+	}
+	free(iov);
+	// Return every page to the free list.
+	for (size_t i = 0; i < buffer->page_count; i++) {
+		buffer->free_pages[buffer->free_count++] = buffer->pages[i];
+	}
+	buffer->page_count = 0;
+	return ok;
+}
+
+bool
+tx_write_buffer_add(threadexec_t threadexec,
+		word_t remote_address, const void *data, size_t size) {
+	struct tx_write_buffer *buffer = threadexec->write_buffer;
+	if (buffer == NULL || buffer->flushing) {
+		return false;
+	}
+	if (size == 0) {
+		return true;
+	}
+	// Make room for the write. If it could never fit, flush anything it overlaps so that the
+	// direct write lands after the older pending writes.
+	size_t needed = new_pages_needed(buffer, remote_address, size);
+	if (needed > buffer->page_capacity) {
+		bool ok = tx_write_buffer_flush_range(threadexec, remote_address, size);
+		// If the older writes didn't land, don't let this one overtake them. The failure is
+		// reported by the next flush, like any other write that doesn't land.
+		return !ok;
+	}
+	if (needed > buffer->free_count) {
+		flush(threadexec, buffer);
+	}
+	// Copy the data into the buffer page by page.
+	const uint8_t *src = data;
+	word_t address = remote_address;
+	word_t end = remote_address + size;
+	while (address < end) {
+		word_t page_address = address - address % PAGE_SIZE_WB;
+		size_t offset = address - page_address;
+		size_t chunk = min(PAGE_SIZE_WB - offset, end - address);
+		struct tx_write_buffer_page *page = get_page(buffer, page_address);
+		memcpy(page->data + offset, src, chunk);
+		mark_dirty(page, offset, offset + chunk);
+		src     += chunk;
+		address += chunk;
+	}
+	return true;
+}
+
+bool
+tx_write_buffer_flush_range(threadexec_t threadexec, word_t remote_address, size_t size) {
+	struct tx_write_buffer *buffer = threadexec->write_buffer;
+	if (buffer == NULL || buffer->page_count == 0 || buffer->flushing) {
+		return true;
+	}
+	if (!overlaps_pending(buffer, remote_address, size)) {
+		return true;
+	}
+	return flush(threadexec, buffer);
+}
+
+void
+tx_write_buffer_deinit(threadexec_t threadexec) {
+	struct tx_write_buffer *buffer = threadexec->write_buffer;
+	if (buffer == NULL) {
+		return;
+	}
+	flush(threadexec, buffer);
+	threadexec->write_buffer = NULL;
+	free(buffer->data_storage);
+	free(buffer->page_storage);
+	free(buffer->free_pages);
+	free(buffer->pages);
+	free(buffer);
+}
+
+bool
+threadexec_write_buffer_enable(threadexec_t threadexec, size_t capacity) {
+	tx_write_buffer_deinit(threadexec);
+	size_t page_capacity = capacity / PAGE_SIZE_WB;
+	if (page_capacity < 1) {
+		ERROR("Write buffer capacity %zu is too small", capacity);
+		return false;
+	}
+	struct tx_write_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		goto fail_0;
+	}
+	buffer->page_capacity = page_capacity;
+	buffer->pages         = calloc(page_capacity, sizeof(*buffer->pages));
+	buffer->free_pages    = calloc(page_capacity, sizeof(*buffer->free_pages));
+	buffer->page_storage  = calloc(page_capacity, sizeof(*buffer->page_storage));
+	buffer->data_storage  = malloc(page_capacity * PAGE_SIZE_WB);
+	if (buffer->pages == NULL || buffer->free_pages == NULL
+			|| buffer->page_storage == NULL || buffer->data_storage == NULL) {
+		goto fail_1;
+	}
+	for (size_t i = 0; i < page_capacity; i++) {
+		buffer->page_storage[i].data = buffer->data_storage + i * PAGE_SIZE_WB;
+		buffer->free_pages[i] = &buffer->page_storage[i];
+	}
+	buffer->free_count = page_capacity;
+	threadexec->write_buffer = buffer;
+	return true;
+fail_1:
+	free(buffer->data_storage);
+	free(buffer->page_storage);
+	free(buffer->free_pages);
+	free(buffer->pages);
+	free(buffer);
+fail_0:
+	ERROR("Could not allocate write buffer");
+	return false;
+}
+
+bool
+threadexec_write_buffer_disable(threadexec_t threadexec) {
+	bool ok = threadexec_write_buffer_flush(threadexec);
+	tx_write_buffer_deinit(threadexec);
+	return ok;
+}
+
+bool
+threadexec_write_buffer_flush(threadexec_t threadexec) {
+	struct tx_write_buffer *buffer = threadexec->write_buffer;
+	if (buffer == NULL) {
+		return true;
+	}
+	bool ok = flush(threadexec, buffer);
+	ok = ok && !buffer->failed;
+	buffer->failed = false;
+	return ok;
+}
@@ -3,6 +3,8 @@
 #include "thread_call.h"
 #include "tx_internal.h"
 #include "tx_log.h"
+#include "tx_stack_profile.h"
+#include "tx_write_buffer.h"
 
 #include <assert.h>
 
@@ -31,10 +33,27 @@ tx_preserve_restore(threadexec_t threadexec) {
 	return true;
 }
 
+// The remote function may read memory we have buffered writes for, so make sure they have landed
+// first.
+static bool
+flush_pending_writes(threadexec_t threadexec) {
+	if (threadexec->write_buffer == NULL) {
+		return true;
+	}
+	bool ok = threadexec_write_buffer_flush(threadexec);
+	if (!ok) {
+		ERROR("Not calling remote function with unflushed writes");
+	}
+	return ok;
+}
+
 bool
 tx_call_regs(threadexec_t threadexec, void *result, size_t result_size,
 		word_t function, unsigned argument_count, const word_t *arguments) {
 #if TX_HAVE_THREAD_API
+	if (!flush_pending_writes(threadexec)) {
+		return false;
+	}
 	return thread_call(threadexec->thread, result, result_size,
 			(word_t) function, argument_count, arguments);
 #else
@@ -57,8 +76,34 @@ tx_call(threadexec_t threadexec,
 		void *result, size_t result_size,
 		word_t function, unsigned argument_count,
 		const struct threadexec_call_argument *arguments) {
-	return thread_call_stack(threadexec->thread, threadexec->stack_base,
+	if (!flush_pending_writes(threadexec)) {
+		return false;
+	}
+	tx_stack_profile_start(threadexec, function);
+	bool ok = thread_call_stack(threadexec->thread, threadexec->stack_base,
 			threadexec->stack_base_remote, threadexec->stack_size,
 			result, result_size,
 			(word_t) function, argument_count, arguments);
+	tx_stack_profile_finish(threadexec);
+	return ok;
+}
+
+bool
+tx_call_async(threadexec_t threadexec,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments) {
+	if (!flush_pending_writes(threadexec)) {
+		return false;
+	}
+	tx_stack_profile_start(threadexec, function);
+	return thread_call_stack_async(threadexec->thread, threadexec->stack_base,
+			threadexec->stack_base_remote, threadexec->stack_size,
+			(word_t) function, argument_count, arguments);
+}
+
+bool
+tx_call_wait(threadexec_t threadexec, void *result, size_t result_size) {
+	bool ok = thread_call_wait(threadexec->thread, result, result_size);
+	tx_stack_profile_finish(threadexec);
+	return ok;
 }
@@ -94,4 +94,48 @@ bool tx_call(threadexec_t threadexec,
 		word_t function, unsigned argument_count,
 		const struct threadexec_call_argument *arguments);
 
+/*
+ * tx_call_async
+ *
+ * Description:
+ * 	Start a function call in the remote thread without waiting for it to return. Arguments
+ * 	can be passed in registers or on the stack.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	function			The address of the remote function to execute.
+ * 	argument_count			The number of arguments to the function.
+ * 	arguments			The array of arguments to the function.
+ *
+ * Returns:
+ * 	Returns true if the call was started.
+ *
+ * Notes:
+ * 	Every successful call to tx_call_async() must be paired with a call to tx_call_wait()
+ * 	before any other remote call is made on the threadexec. Local work that doesn't touch the
+ * 	remote stack may be performed in between, which allows overlapping local and remote
+ * 	processing.
+ */
+bool tx_call_async(threadexec_t threadexec,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments);
+
+/*
+ * tx_call_wait
+ *
+ * Description:
+ * 	Wait for a function call started with tx_call_async() to return.
+ *
+ * Parameters:
+ * 	threadexec			The threadexec context.
+ * 	result			out	On return, contains the return value of the called
+ * 					function.
+ * 	result_size			The size of the function's return value in bytes. Must be a
+ * 					power of 2 no greater than the platform word size.
+ *
+ * Returns:
+ * 	Returns true on success.
+ */
+bool tx_call_wait(threadexec_t threadexec, void *result, size_t result_size);
+
 #endif
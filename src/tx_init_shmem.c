@@ -3,26 +3,138 @@
 #include "tx_internal.h"
 #include "tx_log.h"
 #include "tx_params.h"
+#include "tx_prototypes.h"
+#include "tx_utils.h"
 
 #include <assert.h>
 
+// The size of the staging buffers at the bottom of the shared memory region.
+static size_t
+staging_size(threadexec_t threadexec) {
+	const struct threadexec_init_options *options = &threadexec->shmem_options;
+	return options->staging_buffer_count * options->staging_buffer_size;
+}
+
+// The offset of the guard page between the staging buffers and the stack.
+static size_t
+guard_offset(threadexec_t threadexec) {
+	return round2_up(staging_size(threadexec), (size_t) TX_STACK_GUARD_SIZE);
+}
+
+// The offset of the lowest address the stack can grow to.
+static size_t
+stack_limit_offset(threadexec_t threadexec) {
+	return guard_offset(threadexec) + TX_STACK_GUARD_SIZE;
+}
+
+// The size of the stack region, which includes the staging buffers and the guard page.
+static size_t
+stack_region_size(threadexec_t threadexec) {
+	const struct threadexec_init_options *options = &threadexec->shmem_options;
+	return round2_up(stack_limit_offset(threadexec) + options->stack_size,
+			options->alignment);
+}
+
+// The size of the client region.
+static size_t
+client_region_size(threadexec_t threadexec) {
+	const struct threadexec_init_options *options = &threadexec->shmem_options;
+	size_t client_size = round2_up(options->client_shmem_size, options->alignment);
+	// Superpages need the whole region to be a multiple of the superpage size. Give the extra
+	// space to the client.
+	if (options->superpages) {
+		size_t stack_size = stack_region_size(threadexec);
+		client_size = round2_up(stack_size + client_size, TX_SUPERPAGE_SIZE) - stack_size;
+	}
+	return client_size;
+}
+
+size_t
+tx_init_shmem_size(threadexec_t threadexec) {
+	return stack_region_size(threadexec) + client_region_size(threadexec);
+}
+
 void
 tx_init_shmem_setup_regions(threadexec_t threadexec) {
 	DEBUG_TRACE(2, "Set up shared memory: local = %p, remote = %p, size = %zu",
 			threadexec->shmem, (void *) threadexec->shmem_remote,
 			threadexec->shmem_size);
-	assert(threadexec->shmem_size > TX_CLIENT_SHMEM_SIZE);
-	// Initialize the stack, which is the lower part of the shared memory region.
-	const size_t stack_size  = threadexec->shmem_size - TX_CLIENT_SHMEM_SIZE;
-	void *stack_base         = (uint8_t *)threadexec->shmem + stack_size;
-	word_t stack_base_remote = threadexec->shmem_remote + stack_size;
+	assert(threadexec->shmem_size == tx_init_shmem_size(threadexec));
+	const struct threadexec_init_options *options = &threadexec->shmem_options;
+	// Initialize the stack, which is the lower part of the shared memory region. The staging
+	// buffers sit at the very bottom, followed by a guard page, so the stack can only grow down
+	// to the guard page.
+	const size_t stack_region = stack_region_size(threadexec);
+	void *stack_base         = (uint8_t *)threadexec->shmem + stack_region;
+	word_t stack_base_remote = threadexec->shmem_remote + stack_region;
 	threadexec->stack_base        = stack_base;
 	threadexec->stack_base_remote = stack_base_remote;
-	threadexec->stack_size        = stack_size;
+	threadexec->stack_size        = stack_region - stack_limit_offset(threadexec);
 	// Initialize the client shared memory region, which is the upper part.
-	const size_t client_shmem_size = threadexec->shmem_size - stack_size;
-	assert(client_shmem_size >= 0x8000);
 	threadexec->client_shmem        = stack_base;
 	threadexec->client_shmem_remote = stack_base_remote;
-	threadexec->client_shmem_size   = client_shmem_size;
+	threadexec->client_shmem_size   = client_region_size(threadexec);
+	// Initialize the staging buffers.
+	threadexec->staging              = threadexec->shmem;
+	threadexec->staging_remote       = threadexec->shmem_remote;
+	threadexec->staging_buffer_size  = options->staging_buffer_size;
+	threadexec->staging_buffer_count = options->staging_buffer_count;
+}
+
+bool
+tx_init_shmem_protect_guard(threadexec_t threadexec) {
+	// Only the remote mapping needs the guard: that's the one the stack lives in.
+	word_t guard = threadexec->shmem_remote + guard_offset(threadexec);
+	kern_return_t kr;
+	if (tx_supports_task_api(threadexec)) {
+		kr = mach_vm_protect(threadexec->task, guard, TX_STACK_GUARD_SIZE, FALSE,
+				VM_PROT_NONE);
+	} else {
+		bool ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+				mach_vm_protect, 5,
+				TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+				TX_CARG_LITERAL(mach_vm_address_t, guard),
+				TX_CARG_LITERAL(mach_vm_size_t, TX_STACK_GUARD_SIZE),
+				TX_CARG_LITERAL(boolean_t, FALSE),
+				TX_CARG_LITERAL(vm_prot_t, VM_PROT_NONE));
+		if (!ok) {
+			ERROR_REMOTE_CALL(mach_vm_protect);
+			return false;
+		}
+	}
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "Could not protect stack guard page: %u", kr);
+		return false;
+	}
+	return true;
+}
+
+void
+tx_init_shmem_prefault(threadexec_t threadexec) {
+	const struct threadexec_init_options *options = &threadexec->shmem_options;
+	if (!options->prefault && !options->wire) {
+		return;
+	}
+	// The hot parts of the region are the staging buffers, where call arguments and messages
+	// are also staged, and the stack. The guard page between them can't be touched.
+	const size_t ranges[2][2] = {
+		{ 0,                             guard_offset(threadexec)      },
+		{ stack_limit_offset(threadexec), stack_region_size(threadexec) },
+	};
+	for (size_t i = 0; i < 2; i++) {
+		size_t start = ranges[i][0];
+		size_t size  = ranges[i][1] - start;
+		bool wired;
+		bool prefaulted = tx_shared_vm_prefault(threadexec,
+				(const void *) (threadexec->shmem_remote + start),
+				(uint8_t *) threadexec->shmem + start, size, options->wire, &wired);
+		if (prefaulted) {
+			threadexec->shmem_prefaulted_size += size;
+		}
+		if (wired) {
+			threadexec->shmem_wired_size += size;
+		}
+	}
+	DEBUG_TRACE(1, "Prefaulted %zu bytes of shared memory, %zu wired",
+			threadexec->shmem_prefaulted_size, threadexec->shmem_wired_size);
 }
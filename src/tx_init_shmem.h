@@ -3,6 +3,14 @@
 
 #include "threadexec/threadexec.h"
 
+/*
+ * tx_init_shmem_size
+ *
+ * Description:
+ * 	Get the size of the shared memory region to allocate, based on the init options.
+ */
+size_t tx_init_shmem_size(threadexec_t threadexec);
+
 /*
  * tx_init_shmem_setup_regions
  *
@@ -11,4 +19,23 @@
  */
 void tx_init_shmem_setup_regions(threadexec_t threadexec);
 
+/*
+ * tx_init_shmem_protect_guard
+ *
+ * Description:
+ * 	Make the guard page below the remote stack inaccessible in the remote task, so that a stack
+ * 	overflow faults instead of overwriting the staging buffers. Must be called once the
+ * 	threadexec is fully initialized.
+ */
+bool tx_init_shmem_protect_guard(threadexec_t threadexec);
+
+/*
+ * tx_init_shmem_prefault
+ *
+ * Description:
+ * 	Prefault and optionally wire the staging buffers and stack, as requested by the init
+ * 	options. Must be called once the threadexec is fully initialized.
+ */
+void tx_init_shmem_prefault(threadexec_t threadexec);
+
 #endif
@@ -23,6 +23,13 @@ enum {
 	TX_PRESERVE = 0x10000,
 };
 
+// A shared memory region allocated by the client with threadexec_shared_vm_allocate().
+struct tx_shared_mapping {
+	uint8_t *local;
+	word_t remote;
+	size_t size;
+};
+
 // The threadexec struct.
 struct threadexec {
 	// The task in which we are executing. This may be a task_t or a task_inspect_t or
@@ -47,8 +54,15 @@ struct threadexec {
 	// task to the remote thread.
 	mach_port_t remote_port;
 	mach_port_t remote_port_remote;
-	// The shared memory region. The lower half of this is the stack (growing downwards) and
-	// the upper half is usable for clients.
+	// The geometry of the shared memory region, with the defaults filled in.
+	struct threadexec_init_options shmem_options;
+	// The number of bytes of the shared memory region that were prefaulted and wired.
+	size_t shmem_prefaulted_size;
+	size_t shmem_wired_size;
+	// The shared memory region. From the bottom up it holds the staging buffers, a guard page
+	// that is inaccessible in the remote task, the stack (growing downwards towards the guard
+	// page), and the region usable for clients. The sizes of the parts come from
+	// shmem_options; see tx_init_shmem_setup_regions().
 	void *shmem;
 	word_t shmem_remote;
 	size_t shmem_size;
@@ -63,6 +77,34 @@ struct threadexec {
 	void *client_shmem;
 	word_t client_shmem_remote;
 	size_t client_shmem_size;
+	// The staging buffers used for bulk memory transfers. There are staging_buffer_count
+	// buffers of staging_buffer_size bytes each, laid out contiguously at the bottom of the
+	// stack region. Using more than one buffer allows the remote copy of one chunk to overlap
+	// with the local copy of another.
+	void *staging;
+	word_t staging_remote;
+	size_t staging_buffer_size;
+	unsigned staging_buffer_count;
+	// A pipe used to gather and scatter data for threadexec_readv() and threadexec_writev().
+	// Both ends are held in both tasks. The pipe is created on first use.
+	bool vector_pipe_ready;
+	int vector_pipe[2];
+	int vector_pipe_remote[2];
+	// The read cache used by threadexec_read(), or NULL if caching is disabled.
+	struct tx_read_cache *read_cache;
+	// The write buffer used by threadexec_write(), or NULL if write combining is disabled.
+	struct tx_write_buffer *write_buffer;
+	// The cached map of remote memory regions, or NULL if none has been built.
+	struct tx_vm_map *vm_map;
+	// The pool of shared memory regions used for large threadexec_call_c() arguments, or NULL
+	// if none has been needed yet.
+	struct tx_shared_vm_pool *shared_vm_pool;
+	// The live shared memory regions allocated by the client, sorted by local address, so that
+	// local pointers into them can be translated to remote ones.
+	struct tx_shared_mapping *shared_mappings;
+	size_t shared_mapping_count;
+	// The per-function stack usage, or NULL if stack profiling is disabled.
+	struct tx_stack_profile *stack_profile;
 	// The saved thread state, if this thread is being preserved (TX_PRESERVE).
 	const void *preserve_state;
 };
@@ -91,4 +133,92 @@ tx_supports_task_api(struct threadexec *threadexec) {
  */
 bool tx_init_internal(threadexec_t threadexec);
 
+/*
+ * tx_read_direct
+ *
+ * Description:
+ * 	Read remote memory with the remote thread, bypassing the read cache.
+ */
+bool tx_read_direct(threadexec_t threadexec, word_t remote_address, void *data, size_t size);
+
+/*
+ * tx_safe_transfer
+ *
+ * Description:
+ * 	Read or write remote memory using the kernel to perform the copy, so that bad addresses
+ * 	produce an error rather than a crash. On return, transferred is set to the number of bytes
+ * 	copied from the start of the range.
+ */
+bool tx_safe_transfer(threadexec_t threadexec, word_t remote_address, void *data, size_t size,
+		bool is_write, size_t *transferred);
+
+/*
+ * tx_shared_vm_map_entry
+ *
+ * Description:
+ * 	Map a local memory entry into the remote task read/write, using the task API if possible.
+ * 	If superpage is set, the mapping is aligned so that the remote task can use superpages.
+ */
+bool tx_shared_vm_map_entry(threadexec_t threadexec, mach_port_t memory_entry, size_t size,
+		bool superpage, const void **remote_address);
+
+/*
+ * tx_shared_vm_allocate
+ *
+ * Description:
+ * 	Allocate a shared memory region as threadexec_shared_vm_allocate_flags, but without
+ * 	registering it for pointer translation. This is used for internal regions, into which
+ * 	client pointers should never be translated.
+ */
+bool tx_shared_vm_allocate(threadexec_t threadexec, const void **remote_address,
+		void **local_address, size_t size, unsigned flags);
+
+/*
+ * tx_shared_vm_translate
+ *
+ * Description:
+ * 	If the local range lies entirely within the default client shared memory region or a
+ * 	region allocated with threadexec_shared_vm_allocate, get its remote address.
+ */
+bool tx_shared_vm_translate(threadexec_t threadexec, const void *local_address, size_t size,
+		word_t *remote_address);
+
+/*
+ * tx_shared_vm_owns
+ *
+ * Description:
+ * 	Test whether a remote range overlaps shared memory held by the threadexec context: the
+ * 	session region, the idle regions in the call_c pool, or a region allocated with
+ * 	threadexec_shared_vm_allocate.
+ */
+bool tx_shared_vm_owns(threadexec_t threadexec, word_t remote_address, size_t size);
+
+/*
+ * tx_shared_vm_deinit
+ *
+ * Description:
+ * 	Free the registry of shared memory regions. The regions themselves belong to the client.
+ */
+void tx_shared_vm_deinit(threadexec_t threadexec);
+
+/*
+ * tx_shared_vm_prefault
+ *
+ * Description:
+ * 	Fault in a shared memory region in both the local and the remote task, and optionally wire
+ * 	it. Wiring is all or nothing: if either side can't be wired, neither is. Returns true if
+ * 	the region was prefaulted in the remote task; on return, wired is set if it was wired.
+ */
+bool tx_shared_vm_prefault(threadexec_t threadexec, const void *remote_address,
+		void *local_address, size_t size, bool wire, bool *wired);
+
+/*
+ * tx_vector_io_deinit
+ *
+ * Description:
+ * 	Release the resources used by threadexec_readv() and threadexec_writev(). This must be
+ * 	called while the threadexec can still perform remote calls.
+ */
+void tx_vector_io_deinit(threadexec_t threadexec);
+
 #endif
@@ -0,0 +1,213 @@
+#include "tx_ool_transfer.h"
+
+#include "tx_internal.h"
+#include "tx_log.h"
+#include "tx_prototypes.h"
+
+#define OOL_TRANSFER_MSG_ID 0x139a720
+
+// A Mach message struct for transferring out-of-line memory.
+struct ool_transfer_msg {
+	mach_msg_header_t          hdr;
+	mach_msg_body_t            body;
+	mach_msg_ool_descriptor_t  ool;
+};
+
+struct ool_transfer_msg_trailer {
+	mach_msg_header_t          hdr;
+	mach_msg_body_t            body;
+	mach_msg_ool_descriptor_t  ool;
+	mach_msg_trailer_t         trailer;
+};
+
+// Fill in a message carrying the specified memory as a virtual copy.
+static void
+init_ool_transfer_msg(struct ool_transfer_msg *msg, mach_port_t port, mach_msg_id_t msg_id,
+		word_t address, size_t size) {
+	memset(msg, 0, sizeof(*msg));
+	msg->hdr.msgh_bits              = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_COPY_SEND, 0,
+	                                                     0, MACH_MSGH_BITS_COMPLEX);
+	msg->hdr.msgh_size              = sizeof(*msg);
+	msg->hdr.msgh_remote_port       = port;
+	msg->hdr.msgh_id                = msg_id;
+	msg->body.msgh_descriptor_count = 1;
+	msg->ool.address                = (void *) address;
+	msg->ool.size                   = (mach_msg_size_t) size;
+	msg->ool.deallocate             = FALSE;
+	msg->ool.copy                   = MACH_MSG_VIRTUAL_COPY;
+	msg->ool.type                   = MACH_MSG_OOL_DESCRIPTOR;
+}
+
+// Returns true if copying between the two addresses can be done by remapping pages rather than
+// copying bytes.
+static bool
+page_congruent(word_t a, word_t b) {
+	return ((a ^ b) & vm_page_mask) == 0;
+}
+
+bool
+tx_ool_read(threadexec_t threadexec, word_t remote_address, void *data, size_t size) {
+	bool success = false;
+	if (size > UINT32_MAX) {
+		return false;
+	}
+	// Have the remote thread send the memory to our local port.
+	mach_msg_id_t msg_id = OOL_TRANSFER_MSG_ID;
+	struct ool_transfer_msg *msg = (struct ool_transfer_msg *) threadexec->shmem;
+	init_ool_transfer_msg(msg, threadexec->local_port_remote, msg_id, remote_address, size);
+	struct threadexec_call_argument send_args[7] = {
+		TX_ARG(mach_msg_header_t *, threadexec->shmem_remote),
+		TX_ARG(mach_msg_option_t,   MACH_SEND_MSG),
+		TX_ARG(mach_msg_size_t,     sizeof(*msg)),
+		TX_ARG(mach_msg_size_t,     0),
+		TX_ARG(mach_port_t,         MACH_PORT_NULL),
+		TX_ARG(mach_msg_timeout_t,  MACH_MSG_TIMEOUT_NONE),
+		TX_ARG(mach_port_t,         MACH_PORT_NULL),
+	};
+	DEBUG_TRACE(3, "Calling mach_msg() in remote thread to send %zu bytes", size);
+	kern_return_t kr;
+	bool ok = threadexec_call(threadexec, &kr, sizeof(kr), mach_msg, 7, send_args);
+	if (!ok) {
+		ERROR_REMOTE_CALL(mach_msg);
+		goto fail_0;
+	}
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "Remote mach_msg() failed to send memory: %u", kr);
+		goto fail_0;
+	}
+	// Receive the memory in the local thread. A stale message may be queued ahead of ours, so
+	// discard anything else until ours arrives. Ours has been sent, so this doesn't block.
+	struct ool_transfer_msg_trailer msg_local;
+	for (;;) {
+		kr = mach_msg(&msg_local.hdr,
+				MACH_RCV_MSG,
+				0,
+				sizeof(msg_local),
+				threadexec->local_port,
+				MACH_MSG_TIMEOUT_NONE,
+				MACH_PORT_NULL);
+		if (kr != KERN_SUCCESS) {
+			ERROR_CALL(mach_msg, "%u", kr);
+			goto fail_0;
+		}
+		if (msg_local.hdr.msgh_id == msg_id) {
+			break;
+		}
+		WARNING("Received unexpected message ID %x on %s Mach port",
+				msg_local.hdr.msgh_id, "local");
+		mach_msg_destroy(&msg_local.hdr);
+	}
+	// Move the data into the caller's buffer. If the page offsets line up the kernel can
+	// remap the pages copy-on-write rather than copying them.
+	word_t received = (word_t) msg_local.ool.address;
+	bool copied = false;
+	if (page_congruent(received, (word_t) data)) {
+		kr = mach_vm_copy(mach_task_self(), received, size, (mach_vm_address_t) data);
+		copied = (kr == KERN_SUCCESS);
+	}
+	if (!copied) {
+		memcpy(data, (const void *) received, size);
+	}
+	mach_vm_deallocate(mach_task_self(), received, msg_local.ool.size);
+	success = true;
+fail_0:
+	return success;
+}
+
+bool
+tx_ool_write(threadexec_t threadexec, word_t remote_address, const void *data, size_t size) {
+	bool success = false;
+	if (size > UINT32_MAX) {
+		return false;
+	}
+	// Send the memory to the remote port.
+	mach_msg_id_t msg_id = OOL_TRANSFER_MSG_ID + 1;
+	struct ool_transfer_msg msg;
+	init_ool_transfer_msg(&msg, threadexec->remote_port, msg_id, (word_t) data, size);
+	kern_return_t kr = mach_msg(&msg.hdr,
+			MACH_SEND_MSG,
+			msg.hdr.msgh_size,
+			0,
+			MACH_PORT_NULL,
+			MACH_MSG_TIMEOUT_NONE,
+			MACH_PORT_NULL);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_msg, "%u", kr);
+		goto fail_0;
+	}
+	// Receive the message in the remote thread, discarding any stale messages queued ahead of
+	// ours.
+	struct ool_transfer_msg *remote_msg_local = (struct ool_transfer_msg *) threadexec->shmem;
+	struct threadexec_call_argument recv_args[7] = {
+		TX_ARG(mach_msg_header_t *, threadexec->shmem_remote),
+		TX_ARG(mach_msg_option_t,   MACH_RCV_MSG),
+		TX_ARG(mach_msg_size_t,     0),
+		TX_ARG(mach_msg_size_t,     sizeof(struct ool_transfer_msg_trailer)),
+		TX_ARG(mach_port_t,         threadexec->remote_port_remote),
+		TX_ARG(mach_msg_timeout_t,  MACH_MSG_TIMEOUT_NONE),
+		TX_ARG(mach_port_t,         MACH_PORT_NULL),
+	};
+	bool ok;
+	for (;;) {
+		ok = threadexec_call(threadexec, &kr, sizeof(kr), mach_msg, 7, recv_args);
+		if (!ok) {
+			ERROR_REMOTE_CALL(mach_msg);
+			goto fail_0;
+		}
+		if (kr != KERN_SUCCESS) {
+			ERROR_REMOTE_CALL_FAIL(mach_msg, "%u", kr);
+			goto fail_0;
+		}
+		if (remote_msg_local->hdr.msgh_id == msg_id) {
+			break;
+		}
+		WARNING("Received unexpected message ID %x on %s Mach port",
+				remote_msg_local->hdr.msgh_id, "remote");
+		ok = threadexec_call_cv(threadexec, NULL, 0,
+				mach_msg_destroy, 1,
+				TX_CARG_LITERAL(mach_msg_header_t *, threadexec->shmem_remote));
+		if (!ok) {
+			ERROR_REMOTE_CALL(mach_msg_destroy);
+			goto fail_0;
+		}
+	}
+	word_t received = (word_t) remote_msg_local->ool.address;
+	mach_msg_size_t received_size = remote_msg_local->ool.size;
+	// Move the data into place in the remote task, remapping pages where possible.
+	kr = KERN_FAILURE;
+	if (page_congruent(received, remote_address)) {
+		ok = threadexec_call_cv(threadexec, &kr, sizeof(kr),
+				mach_vm_copy, 4,
+				TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+				TX_CARG_LITERAL(mach_vm_address_t, received),
+				TX_CARG_LITERAL(mach_vm_size_t, size),
+				TX_CARG_LITERAL(mach_vm_address_t, remote_address));
+		if (!ok) {
+			ERROR_REMOTE_CALL(mach_vm_copy);
+			goto fail_1;
+		}
+	}
+	if (kr != KERN_SUCCESS) {
+		ok = threadexec_call_cv(threadexec, NULL, 0,
+				memcpy, 3,
+				TX_CARG_LITERAL(word_t, remote_address),
+				TX_CARG_LITERAL(word_t, received),
+				TX_CARG_LITERAL(size_t, size));
+		if (!ok) {
+			ERROR_REMOTE_CALL(memcpy);
+			goto fail_1;
+		}
+	}
+	success = true;
+fail_1:
+	ok = threadexec_call_cv(threadexec, NULL, 0,
+			mach_vm_deallocate, 3,
+			TX_CARG_LITERAL(vm_map_t, threadexec->task_remote),
+			TX_CARG_LITERAL(mach_vm_address_t, received),
+			TX_CARG_LITERAL(mach_vm_size_t, received_size));
+	if (!ok) {
+		ERROR_REMOTE_CALL(mach_vm_deallocate);
+	}
+fail_0:
+	return success;
+}
@@ -0,0 +1,24 @@
+#ifndef THREADEXEC__TX_OOL_TRANSFER_H_
+#define THREADEXEC__TX_OOL_TRANSFER_H_
+
+#include "threadexec/threadexec.h"
+
+/*
+ * tx_ool_read
+ *
+ * Description:
+ * 	Read remote memory by having the remote thread send it to us as out-of-line memory in a
+ * 	Mach message. The kernel makes a virtual copy of the data rather than copying it.
+ */
+bool tx_ool_read(threadexec_t threadexec, word_t remote_address, void *data, size_t size);
+
+/*
+ * tx_ool_write
+ *
+ * Description:
+ * 	Write remote memory by sending the data to the remote thread as out-of-line memory in a
+ * 	Mach message.
+ */
+bool tx_ool_write(threadexec_t threadexec, word_t remote_address, const void *data, size_t size);
+
+#endif
@@ -1,8 +1,40 @@
 #ifndef THREADEXEC__TX_PARAMS_H_
 #define THREADEXEC__TX_PARAMS_H_
 
-#define TX_SHARED_MEMORY_SIZE (8 * 0x4000)
+#define TX_STACK_SIZE (4 * 0x4000)
+
+#define TX_SHMEM_ALIGNMENT 0x4000
+
+#define TX_STACK_GUARD_SIZE 0x4000
+
+#define TX_SUPERPAGE_SIZE 0x200000
 
 #define TX_CLIENT_SHMEM_SIZE (2 * 0x4000)
 
+#define TX_STAGING_BUFFER_SIZE 0x4000
+
+#define TX_STAGING_BUFFER_COUNT 2
+
+#define TX_VECTOR_BATCH_SIZE 0x4000
+
+#define TX_READ_CACHE_PAGE_SIZE 0x1000
+
+#define TX_WRITE_BUFFER_PAGE_SIZE 0x1000
+
+#define TX_OOL_TRANSFER_THRESHOLD 0x100000
+
+#define TX_MIRROR_BLOCK_SIZE 0x100
+
+#define TX_COPY_CHUNK_SIZE 0x100000
+
+#define TX_DUMP_WINDOW_SIZE 0x1000000
+
+#define TX_SCAN_BATCH_SIZE 0x10000000
+
+#define TX_SCAN_CHUNK_SIZE 0x100000
+
+#define TX_SHARED_VM_POOL_MIN_SIZE 0x10000
+
+#define TX_SHARED_VM_POOL_IDLE_LIMIT 0x1000000
+
 #endif
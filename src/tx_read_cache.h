@@ -0,0 +1,33 @@
+#ifndef THREADEXEC__TX_READ_CACHE_H_
+#define THREADEXEC__TX_READ_CACHE_H_
+
+#include "threadexec/threadexec.h"
+
+/*
+ * tx_read_cache_read
+ *
+ * Description:
+ * 	Satisfy a threadexec_read() through the read cache. The read cache must be enabled.
+ */
+bool tx_read_cache_read(threadexec_t threadexec,
+		word_t remote_address, void *data, size_t size);
+
+/*
+ * tx_read_cache_update
+ *
+ * Description:
+ * 	Update any cached pages overlapping a range of remote memory that was just written. If
+ * 	data is NULL, the cached pages are invalidated instead.
+ */
+void tx_read_cache_update(threadexec_t threadexec,
+		word_t remote_address, const void *data, size_t size);
+
+/*
+ * tx_read_cache_deinit
+ *
+ * Description:
+ * 	Free the read cache, if any.
+ */
+void tx_read_cache_deinit(threadexec_t threadexec);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef THREADEXEC__TX_SHARED_VM_POOL_H_
+#define THREADEXEC__TX_SHARED_VM_POOL_H_
+
+#include "threadexec/threadexec.h"
+
+/*
+ * tx_shared_vm_pool_allocate
+ *
+ * Description:
+ * 	Get a shared memory region of at least the specified size from the pool, creating a new
+ * 	mapping if no idle one of the right size class is available.
+ */
+bool tx_shared_vm_pool_allocate(threadexec_t threadexec, size_t size,
+		const void **remote_address, void **local_address);
+
+/*
+ * tx_shared_vm_pool_free
+ *
+ * Description:
+ * 	Return a region obtained from tx_shared_vm_pool_allocate to the pool. The size must be the
+ * 	size passed to tx_shared_vm_pool_allocate.
+ */
+void tx_shared_vm_pool_free(threadexec_t threadexec, const void *remote_address,
+		void *local_address, size_t size);
+
+/*
+ * tx_shared_vm_pool_usage
+ *
+ * Description:
+ * 	Get the total size of the regions in the pool and the size of the idle ones.
+ */
+void tx_shared_vm_pool_usage(threadexec_t threadexec, size_t *size, size_t *idle_size);
+
+/*
+ * tx_shared_vm_pool_overlaps
+ *
+ * Description:
+ * 	Test whether a remote range overlaps any idle region in the pool.
+ */
+bool tx_shared_vm_pool_overlaps(threadexec_t threadexec, word_t remote_address, size_t size);
+
+/*
+ * tx_shared_vm_pool_deinit
+ *
+ * Description:
+ * 	Unmap every idle region in the pool and free the pool, if any.
+ */
+void tx_shared_vm_pool_deinit(threadexec_t threadexec);
+
+#endif
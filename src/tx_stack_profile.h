@@ -0,0 +1,32 @@
+#ifndef THREADEXEC__TX_STACK_PROFILE_H_
+#define THREADEXEC__TX_STACK_PROFILE_H_
+
+#include "threadexec/threadexec.h"
+
+/*
+ * tx_stack_profile_start
+ *
+ * Description:
+ * 	Note that a remote call to the specified function is starting, if stack profiling is
+ * 	enabled.
+ */
+void tx_stack_profile_start(threadexec_t threadexec, word_t function);
+
+/*
+ * tx_stack_profile_finish
+ *
+ * Description:
+ * 	Measure the stack used by the call that just finished and repaint the stack, if stack
+ * 	profiling is enabled.
+ */
+void tx_stack_profile_finish(threadexec_t threadexec);
+
+/*
+ * tx_stack_profile_deinit
+ *
+ * Description:
+ * 	Free the stack profile, if any.
+ */
+void tx_stack_profile_deinit(threadexec_t threadexec);
+
+#endif
@@ -1,6 +1,7 @@
 #include "tx_utils.h"
 
 #include "tx_log.h"
+#include "tx_params.h"
 
 bool
 thread_suspend_check(thread_act_t thread) {
@@ -93,3 +94,22 @@ mach_port_allocate_receive_and_send() {
 	}
 	return port;
 }
+
+bool
+mach_vm_allocate_local(mach_vm_address_t *address, size_t size, bool superpage) {
+	kern_return_t kr;
+	if (superpage && size % TX_SUPERPAGE_SIZE == 0) {
+		kr = mach_vm_allocate(mach_task_self(), address, size,
+				VM_FLAGS_ANYWHERE | VM_FLAGS_SUPERPAGE_SIZE_2MB);
+		if (kr == KERN_SUCCESS) {
+			return true;
+		}
+		DEBUG_TRACE(1, "Superpage allocation of size %zu failed: %u", size, kr);
+	}
+	kr = mach_vm_allocate(mach_task_self(), address, size, VM_FLAGS_ANYWHERE);
+	if (kr != KERN_SUCCESS) {
+		ERROR_CALL(mach_vm_allocate, "%u", kr);
+		return false;
+	}
+	return true;
+}
@@ -60,6 +60,16 @@ int thread_get_run_state(thread_inspect_t thread);
  */
 mach_port_t mach_port_allocate_receive_and_send();
 
+/*
+ * mach_vm_allocate_local
+ *
+ * Description:
+ * 	Allocate memory in the local task. If superpage is true and the size is a multiple of
+ * 	TX_SUPERPAGE_SIZE, try to back the allocation with superpages first, falling back to
+ * 	regular pages if the kernel refuses.
+ */
+bool mach_vm_allocate_local(mach_vm_address_t *address, size_t size, bool superpage);
+
 /*
  * macro min
  *
@@ -71,6 +81,17 @@ mach_port_t mach_port_allocate_receive_and_send();
 	   __typeof__(b) _min_b = (b);						\
 	   (_min_a < _min_b ? _min_a : _min_b); })
 
+/*
+ * macro max
+ *
+ * Description:
+ * 	Find the maximum of two values.
+ */
+#define max(a, b)								\
+	({ __typeof__(a) _max_a = (a);						\
+	   __typeof__(b) _max_b = (b);						\
+	   (_max_a > _max_b ? _max_a : _max_b); })
+
 
 /*
  * pack_uint
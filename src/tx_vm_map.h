@@ -0,0 +1,28 @@
+#ifndef THREADEXEC__TX_VM_MAP_H_
+#define THREADEXEC__TX_VM_MAP_H_
+
+#include "threadexec/threadexec.h"
+
+/*
+ * tx_vm_map_check
+ *
+ * Description:
+ * 	Check the cached region map to see whether a range of remote memory is mapped with at
+ * 	least the specified protection. If the check fails and refresh is true, the region map is
+ * 	refreshed over the range and checked again.
+ *
+ * 	If there is no cached region map, nothing is known about the remote address space and the
+ * 	check succeeds.
+ */
+bool tx_vm_map_check(threadexec_t threadexec, word_t remote_address, size_t size,
+		vm_prot_t protection, bool refresh);
+
+/*
+ * tx_vm_map_deinit
+ *
+ * Description:
+ * 	Free the cached region map, if any.
+ */
+void tx_vm_map_deinit(threadexec_t threadexec);
+
+#endif
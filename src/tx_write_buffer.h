@@ -0,0 +1,33 @@
+#ifndef THREADEXEC__TX_WRITE_BUFFER_H_
+#define THREADEXEC__TX_WRITE_BUFFER_H_
+
+#include "threadexec/threadexec.h"
+
+/*
+ * tx_write_buffer_add
+ *
+ * Description:
+ * 	Try to absorb a threadexec_write() into the write buffer. Returns false if the write was
+ * 	not buffered and must be performed directly; any pending writes it overlaps have already
+ * 	been flushed in that case.
+ */
+bool tx_write_buffer_add(threadexec_t threadexec,
+		word_t remote_address, const void *data, size_t size);
+
+/*
+ * tx_write_buffer_flush_range
+ *
+ * Description:
+ * 	Flush the write buffer if any pending write overlaps the specified range of remote memory.
+ */
+bool tx_write_buffer_flush_range(threadexec_t threadexec, word_t remote_address, size_t size);
+
+/*
+ * tx_write_buffer_deinit
+ *
+ * Description:
+ * 	Flush any pending writes and free the write buffer, if any.
+ */
+void tx_write_buffer_deinit(threadexec_t threadexec);
+
+#endif
@@ -39,16 +39,12 @@ find_jmp_rbx() {
 	return jmp_rbx;
 }
 
-// Some code common to both thread_call_x86_64 routines.
+// Set the thread state and start the thread running. Our caller has set up the thread state to
+// have the thread infinite loop on a 'jmp rbx' gadget once the function returns.
+// NOTE: We could also make the thread crash on completion and set ourselves up as the exception
+// handler, which would eliminate the need for the gadget, but this seems simpler.
 static bool
-set_state_run_thread_wait_and_stop_thread(const char *_func,
-		thread_act_t thread, x86_thread_state64_t *state) {
-	// Our caller has set up the thread state to have the thread infinite loop on a 'jmp rbx'
-	// gadget once the function returns.
-	// NOTE: We could also make the thread crash on completion and set ourselves up as the
-	// exception handler, which would eliminate the need for the gadget, but this seems
-	// simpler.
-	uint64_t jmp_rbx = find_jmp_rbx();
+set_state_and_run_thread(const char *_func, thread_act_t thread, x86_thread_state64_t *state) {
 	// Set the new state in the thread.
 	bool success = thread_set_state_x86_64(thread, state);
 	if (!success) {
@@ -61,7 +57,16 @@ set_state_run_thread_wait_and_stop_thread(const char *_func,
 		ERROR("%s: Failed to resume thread %x", _func, thread);
 		return false;
 	}
+	return true;
+}
+
+// Wait for a thread started with set_state_and_run_thread() to reach the 'jmp rbx' gadget and
+// then suspend it.
+static bool
+wait_and_stop_thread(const char *_func, thread_act_t thread, x86_thread_state64_t *state) {
+	uint64_t jmp_rbx = find_jmp_rbx();
 	// Wait until the thread is in the expected state.
+	bool success;
 	for (;;) {
 		success = thread_get_state_x86_64(thread, state);
 		if (!success) {
@@ -123,10 +128,10 @@ lay_out_arguments(uint64_t *registers, void *stack, size_t stack_size,
 	return (i == argument_count);
 }
 
-bool
-thread_call_stack_x86_64(thread_act_t thread,
+// Lay out the arguments for a stack-based function call and start the thread running.
+static bool
+start_thread_call_stack(const char *_func, thread_act_t thread,
 		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
-		void *result, size_t result_size,
 		word_t function, unsigned argument_count,
 		const struct threadexec_call_argument *arguments) {
 	// Get the jmp rbx gadget we'll need for later.
@@ -146,12 +151,12 @@ thread_call_stack_x86_64(thread_act_t thread,
 	}
 	// Now make sure we have the gadget.
 	if (jmp_rbx == 0) {
-		ERROR("%s: Could not locate 'jmp rbx' gadget!", __func__);
+		ERROR("%s: Could not locate 'jmp rbx' gadget!", _func);
 		return false;
 	}
 	// And now make sure the arguments will work.
 	if (!args_ok) {
-		ERROR("%s: Unsupported number of arguments: %zu", __func__, argument_count);
+		ERROR("%s: Unsupported number of arguments: %zu", _func, argument_count);
 		return false;
 	}
 	// Set the values of the registers to execute our function call. We set registers rdi, ...,
@@ -172,8 +177,39 @@ thread_call_stack_x86_64(thread_act_t thread,
 	stack        -= sizeof(uint64_t);
 	*(uint64_t *)stack = jmp_rbx;
 	state.__rsp = remote_stack;
-	// Alright, now do the actual execution.
-	bool success = set_state_run_thread_wait_and_stop_thread(__func__, thread, &state);
+	// Alright, now start the execution.
+	return set_state_and_run_thread(_func, thread, &state);
+}
+
+bool
+thread_call_stack_x86_64(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		void *result, size_t result_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments) {
+	bool success = start_thread_call_stack(__func__, thread,
+			local_stack_base, remote_stack_base, stack_size,
+			function, argument_count, arguments);
+	if (!success || function == 0) {
+		return success;
+	}
+	return thread_call_wait_x86_64(thread, result, result_size);
+}
+
+bool
+thread_call_stack_async_x86_64(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments) {
+	return start_thread_call_stack(__func__, thread,
+			local_stack_base, remote_stack_base, stack_size,
+			function, argument_count, arguments);
+}
+
+bool
+thread_call_wait_x86_64(thread_act_t thread, void *result, size_t result_size) {
+	x86_thread_state64_t state;
+	bool success = wait_and_stop_thread(__func__, thread, &state);
 	if (!success) {
 		return false;
 	}
@@ -29,4 +29,23 @@ bool thread_call_stack_x86_64(thread_act_t thread,
 		word_t function, unsigned argument_count,
 		const struct threadexec_call_argument *arguments);
 
+/*
+ * thread_call_stack_async_x86_64
+ *
+ * Description:
+ * 	The thread_call_stack_async implementation for x86-64.
+ */
+bool thread_call_stack_async_x86_64(thread_act_t thread,
+		void *local_stack_base, word_t remote_stack_base, size_t stack_size,
+		word_t function, unsigned argument_count,
+		const struct threadexec_call_argument *arguments);
+
+/*
+ * thread_call_wait_x86_64
+ *
+ * Description:
+ * 	The thread_call_wait implementation for x86-64.
+ */
+bool thread_call_wait_x86_64(thread_act_t thread, void *result, size_t result_size);
+
 #endif
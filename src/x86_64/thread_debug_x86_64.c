@@ -0,0 +1,118 @@
+#include "x86_64/thread_debug_x86_64.h"
+
+#include "tx_log.h"
+
+#include <mach/thread_status.h>
+
+// DR0 through DR3.
+#define WATCHPOINT_COUNT	4
+
+// DR7 fields for debug register i.
+#define DR7_LOCAL_ENABLE(i)	(1ULL << (2 * (i)))
+#define DR7_RW_SHIFT(i)		(16 + 4 * (i))
+#define DR7_LEN_SHIFT(i)	(18 + 4 * (i))
+#define DR7_RW_WRITE		1ULL
+#define DR7_RW_READ_WRITE	3ULL
+
+static bool
+get_debug_state(thread_act_t thread, x86_debug_state64_t *state) {
+	mach_msg_type_number_t count = x86_DEBUG_STATE64_COUNT;
+	kern_return_t kr = thread_get_state(thread, x86_DEBUG_STATE64,
+			(thread_state_t) state, &count);
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "%s: thread_get_state(0x%x): %u", __func__, thread, kr);
+		return false;
+	}
+	return true;
+}
+
+static bool
+set_debug_state(thread_act_t thread, x86_debug_state64_t *state) {
+	kern_return_t kr = thread_set_state(thread, x86_DEBUG_STATE64,
+			(thread_state_t) state, x86_DEBUG_STATE64_COUNT);
+	if (kr != KERN_SUCCESS) {
+		DEBUG_TRACE(1, "%s: thread_set_state(0x%x): %u", __func__, thread, kr);
+		return false;
+	}
+	return true;
+}
+
+static uint64_t *
+debug_address_register(x86_debug_state64_t *state, unsigned i) {
+	uint64_t *drs[WATCHPOINT_COUNT] = { &state->__dr0, &state->__dr1, &state->__dr2,
+		&state->__dr3 };
+	return drs[i];
+}
+
+// Encode a watchpoint length in DR7 format.
+static uint64_t
+dr7_len(size_t size) {
+	switch (size) {
+		case 1:  return 0;
+		case 2:  return 1;
+		case 8:  return 2;
+		default: return 3;
+	}
+}
+
+unsigned
+thread_watchpoint_count_x86_64() {
+	return WATCHPOINT_COUNT;
+}
+
+bool
+thread_set_watchpoints_x86_64(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count) {
+	x86_debug_state64_t state;
+	bool ok = get_debug_state(thread, &state);
+	if (!ok) {
+		return false;
+	}
+	for (unsigned i = 0; i < WATCHPOINT_COUNT; i++) {
+		*debug_address_register(&state, i) = 0;
+		state.__dr7 &= ~(DR7_LOCAL_ENABLE(i) | (0xfULL << DR7_RW_SHIFT(i)));
+		if (i >= count) {
+			continue;
+		}
+		// x86 has no read-only watchpoints, so a read watchpoint also catches writes.
+		const struct thread_watchpoint *wp = &watchpoints[i];
+		uint64_t rw = (wp->read ? DR7_RW_READ_WRITE : DR7_RW_WRITE);
+		*debug_address_register(&state, i) = wp->address;
+		state.__dr7 |= DR7_LOCAL_ENABLE(i) | (rw << DR7_RW_SHIFT(i))
+			| (dr7_len(wp->size) << DR7_LEN_SHIFT(i));
+	}
+	return set_debug_state(thread, &state);
+}
+
+bool
+thread_watchpoint_decode_x86_64(thread_act_t thread, const int64_t *code,
+		unsigned code_count, word_t *address) {
+	// DR6 records which debug register triggered.
+	x86_debug_state64_t state;
+	bool ok = get_debug_state(thread, &state);
+	if (!ok) {
+		return false;
+	}
+	for (unsigned i = 0; i < WATCHPOINT_COUNT; i++) {
+		if ((state.__dr6 & (1ULL << i)) && (state.__dr7 & DR7_LOCAL_ENABLE(i))) {
+			*address = *debug_address_register(&state, i);
+			state.__dr6 = 0;
+			set_debug_state(thread, &state);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+thread_get_pc_x86_64(thread_act_t thread, word_t *pc) {
+	x86_thread_state64_t state;
+	mach_msg_type_number_t count = x86_THREAD_STATE64_COUNT;
+	kern_return_t kr = thread_get_state(thread, x86_THREAD_STATE64,
+			(thread_state_t) &state, &count);
+	if (kr != KERN_SUCCESS) {
+		return false;
+	}
+	*pc = state.__rip;
+	return true;
+}
@@ -0,0 +1,40 @@
+#ifndef THREAD_CALL__X86_64__THREAD_DEBUG_X86_64_H_
+#define THREAD_CALL__X86_64__THREAD_DEBUG_X86_64_H_
+
+#include "thread_debug.h"
+
+/*
+ * thread_watchpoint_count_x86_64
+ *
+ * Description:
+ * 	The thread_watchpoint_count implementation for x86_64.
+ */
+unsigned thread_watchpoint_count_x86_64(void);
+
+/*
+ * thread_set_watchpoints_x86_64
+ *
+ * Description:
+ * 	The thread_set_watchpoints implementation for x86_64.
+ */
+bool thread_set_watchpoints_x86_64(thread_act_t thread,
+		const struct thread_watchpoint *watchpoints, unsigned count);
+
+/*
+ * thread_watchpoint_decode_x86_64
+ *
+ * Description:
+ * 	The thread_watchpoint_decode implementation for x86_64.
+ */
+bool thread_watchpoint_decode_x86_64(thread_act_t thread, const int64_t *code,
+		unsigned code_count, word_t *address);
+
+/*
+ * thread_get_pc_x86_64
+ *
+ * Description:
+ * 	The thread_get_pc implementation for x86_64.
+ */
+bool thread_get_pc_x86_64(thread_act_t thread, word_t *pc);
+
+#endif